@@ -4,11 +4,8 @@
 #include "colouring.hh"
 #include "printf.hh"
 
-int GetNameAttr(const StatType &Stat, std::string_view fn)
+static int GetTypeAttr(const StatType &Stat)
 {
-    int NameAttr = NameColor(fn, -1);
-    if(NameAttr != -1) return NameAttr;
-
     #ifdef S_ISLNK
     if(S_ISLNK(Stat.st_mode))       return GetModeColor(ColorMode::TYPE, -'l');
     else
@@ -31,6 +28,23 @@ int GetNameAttr(const StatType &Stat, std::string_view fn)
     return GetModeColor(ColorMode::TYPE, -'?'); // Unknown type
 }
 
+int GetNameAttr(const StatType &Stat, std::string_view fn)
+{
+    // Without colours, only whether the name is printed as blanks
+    // matters. If the type colour is not blanks and no byext colour
+    // is, the name colour would not change that.
+    if(Monochrome && !NameColorsBlank())
+    {
+        int TypeAttr = GetTypeAttr(Stat);
+        if(!BlankAttr(TypeAttr)) return TypeAttr;
+    }
+
+    int NameAttr = NameColor(fn, -1);
+    if(NameAttr != -1) return NameAttr;
+
+    return GetTypeAttr(Stat);
+}
+
 int PrintAttr(const StatType &Stat, char Attrs
 #ifdef DJGPP
     , unsigned int dosattr
@@ -39,7 +39,15 @@
 #define HAVE_GETPWUID
 #define HAVE_FLOCK_SYS_FILE_H
 #define HAVE_FLOCK
+#define HAVE_GETDENTS64_DIRENT_H
+#define HAVE_GETDENTS64
+#define HAVE_FSTATAT_SYS_STAT_H
+#define HAVE_FSTATAT
+#define HAVE_STATX_SYS_STAT_H
+#define HAVE_STATX
+#define HAVE_STD_THREAD
 #define HAVE_STDIO_FILEBUF
+#define HAVE_IO_URING_STATX
 #define HAVE_CONCEPTS
 #define LIKELY   [[likely]]
 #define UNLIKELY [[unlikely]]
@@ -4,6 +4,8 @@
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <array>
+#include <cstdint>
 
 using namespace std;
 
@@ -46,6 +48,11 @@ int _crt0_startup_flags =
 # include <termios.h>
 #endif
 
+#ifndef DJGPP
+# include <cerrno>
+# include <unistd.h>
+#endif
+
 bool Colors     = true;
 bool AnsiOpt    = true;
 bool Pagebreaks = false;
@@ -68,11 +75,78 @@ int OldAttr  = DEFAULTATTR;
  *                              u = 0x20000 for bold
  */
 
+#ifndef DJGPP
+/* Everything is printed into this buffer, which is written out with
+ * write() when it is full, before the pager waits for a key, and at exit.
+ * On a terminal, it is also written out at the end of each line, so
+ * that a slow listing appears as it goes.
+ */
+static class OutputBuffer
+{
+    static const std::size_t Size = 256*1024;
+    char*       data;
+    std::size_t length = 0;
+    bool        lines;     // Written out at each newline
+public:
+    OutputBuffer() : data(new char[Size]), lines(isatty(1)) { }
+    ~OutputBuffer() { Flush(); delete[] data; }
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void Put(char c)
+    {
+        if(length == Size) Flush();
+        data[length++] = c;
+        if(c == '\n' && lines) Flush();
+    }
+    void Put(const char* s, std::size_t n)
+    {
+        if(n > Size - length)
+        {
+            Flush();
+            if(n >= Size) { Write(s, n); return; }
+        }
+        std::memcpy(data + length, s, n);
+        length += n;
+        if(lines && std::memchr(s, '\n', n)) Flush();
+    }
+    void Flush()
+    {
+        Write(data, length);
+        length = 0;
+    }
+private:
+    static void Write(const char* s, std::size_t n)
+    {
+        while(n > 0)
+        {
+            ssize_t r = write(1, s, n);
+            if(r < 0 && errno == EINTR) continue;
+            if(r <= 0) break; // Nowhere to write. Drop it.
+            s += r;
+            n -= r;
+        }
+    }
+} Output;
+#endif
+
+void Gflush()
+{
+#ifndef DJGPP
+    Output.Flush();
+#endif
+}
+
 static unsigned BackgroundOf(unsigned attr) { return (attr & 0x100) ? ((attr >> 9) & 0xFF) : ((attr >> 4) & 0x07); }
 static unsigned ForegroundOf(unsigned attr) { return (attr & 0x100) ? (attr & 0xFF)        : (attr & 0x07); }
 static bool     BoldOf(unsigned attr)       { return (attr & 0x100) ? (attr & 0x20000)     : (attr & 0x8); }
 static bool     BlinkOf(unsigned attr)      { return (attr & 0x100) ? false                : (attr & 0x80); }
 
+bool BlankAttr(int attr)
+{
+    return BackgroundOf(attr) == ForegroundOf(attr);
+}
+
 static class GetScreenGeometry
 {
 public:
@@ -114,116 +188,148 @@ void GetScreenGeometry()
     ScreenInitializer.Get();
 }
 
-static void FlushSetAttr()
+#ifndef DJGPP
+// MakeSGR: Writes into Buffer the escape sequence that changes
+// the attribute from OldAttr into TextAttr. Returns its length.
+static unsigned MakeSGR(char (&Buffer)[32], int OldAttr, int TextAttr)
 {
-    if(TextAttr == OldAttr)return;
-    if(Colors)
-    {
-#ifdef DJGPP
-        textattr(TextAttr);
-#else
-        // max length for 16-colors:   "e[0;1;5;40;30m"           = 14 characters
-        // max length for 256-colors:  "e[0;38;5;255;48;5;255;1m" = 24 characters
-        char Buffer[32]={'\33','['};
-        unsigned Buflen=2;
+    // max length for 16-colors:   "e[0;1;5;40;30m"           = 14 characters
+    // max length for 256-colors:  "e[0;38;5;255;48;5;255;1m" = 24 characters
+    Buffer[0] = '\33'; Buffer[1] = '[';
+    unsigned Buflen=2;
 
-        if(TextAttr != DEFAULTATTR)
+    if(TextAttr != DEFAULTATTR)
+    {
+        bool pp           = false; // semicolon needed
+        bool reset_needed = false;
+        auto param = [&]{ if(pp) Buffer[Buflen++]=';'; pp=true; };
+        auto appint = [&](unsigned value)
         {
-            bool pp           = false; // semicolon needed
-            bool reset_needed = false;
-            auto param = [&]{ if(pp) Buffer[Buflen++]=';'; pp=true; };
-            auto appint = [&](unsigned value)
+            param();
+            if(value >= 100)
             {
-                param();
-                if(value >= 100)
-                {
-                    if(value >= 10000) Buffer[Buflen++] = '0' + (value/10000u)%10u;
-                    if(value >= 1000)  Buffer[Buflen++] = '0' + (value/1000u)%10u;
-                    Buffer[Buflen++] = '0' + (value/100u)%10u;
-                }
-                if(value >= 10) Buffer[Buflen++] = '0' + (value/10u)%10u;
-                Buffer[Buflen++] = '0' + (value/1u)%10u;
-            };
-            auto appcolor = [&](int value, int lowdelta, int highdelta, const char* xterm)
+                if(value >= 10000) Buffer[Buflen++] = '0' + (value/10000u)%10u;
+                if(value >= 1000)  Buffer[Buflen++] = '0' + (value/1000u)%10u;
+                Buffer[Buflen++] = '0' + (value/100u)%10u;
+            }
+            if(value >= 10) Buffer[Buflen++] = '0' + (value/10u)%10u;
+            Buffer[Buflen++] = '0' + (value/1u)%10u;
+        };
+        auto appcolor = [&](int value, int lowdelta, int highdelta, const char* xterm)
+        {
+            if(value < 16)
             {
-                if(value < 16)
-                {
-                    appint((value & 7) + ((value & 8) ? highdelta : lowdelta));
-                }
-                else
-                {
-                    param();
-                    memcpy(Buffer+Buflen, xterm, 5); Buflen += 5; pp=false;
-                    appint(value);
-                }
-            };
-
-            static const char Swap[8] = {0,4,2,6,1,5,3,7};
-            if(AnsiOpt)
+                appint((value & 7) + ((value & 8) ? highdelta : lowdelta));
+            }
+            else
             {
-                struct Data { bool legacy,blink,intens; unsigned bg,fg; } olddata, newdata;
+                param();
+                memcpy(Buffer+Buflen, xterm, 5); Buflen += 5; pp=false;
+                appint(value);
+            }
+        };
 
-                newdata = { !bool(TextAttr&0x100), BlinkOf(TextAttr),BoldOf(TextAttr), BackgroundOf(TextAttr),ForegroundOf(TextAttr)};
-                olddata = { !bool(OldAttr&0x100 ), BlinkOf(OldAttr), BoldOf(OldAttr),  BackgroundOf(OldAttr), ForegroundOf(OldAttr) };
+        static const char Swap[8] = {0,4,2,6,1,5,3,7};
+        if(AnsiOpt)
+        {
+            struct Data { bool legacy,blink,intens; unsigned bg,fg; } olddata, newdata;
 
-                if( (olddata.blink != newdata.blink)
-                  + (olddata.intens != newdata.intens) >= 1
-                &&  (olddata.bg != newdata.bg)
-                  + (olddata.fg != newdata.fg) >= 1)
-                {
-                    reset_needed = true;
-                }
+            newdata = { !bool(TextAttr&0x100), BlinkOf(TextAttr),BoldOf(TextAttr), BackgroundOf(TextAttr),ForegroundOf(TextAttr)};
+            olddata = { !bool(OldAttr&0x100 ), BlinkOf(OldAttr), BoldOf(OldAttr),  BackgroundOf(OldAttr), ForegroundOf(OldAttr) };
 
-                if(reset_needed)
-                {
-                    // '0' resets both blink and intensity flags
-                    appint(0);
-                    OldAttr = DEFAULTATTR; // Presumed default color
-                    olddata = { !bool(OldAttr&0x100), BlinkOf(OldAttr), BoldOf(OldAttr),  BackgroundOf(OldAttr), ForegroundOf(OldAttr)};
-                }
-                if(newdata.intens && !olddata.intens) { appint(1); } // Add bold
-                if(newdata.blink  && !olddata.blink)  { appint(5); } // Add blink
-                if(!newdata.intens && olddata.intens) { appint(22); } // Remove bold
-                if(!newdata.blink  && olddata.blink)  { appint(25); } // Remove blink
-                if(newdata.bg != olddata.bg)
-                {
-                    // Renew background color
-                    if(newdata.legacy)
-                        appint(40 + Swap[newdata.bg]);
-                    else
-                        appcolor(newdata.bg, 40,100, "48;5;");
-                }
-                if(newdata.fg != olddata.fg)
-                {
-                    // Renew foreground color
-                    if(newdata.legacy)
-                        appint(30 + Swap[newdata.fg]);
-                    else
-                        appcolor(newdata.fg, 30,90, "38;5;");
-                }
+            if( (olddata.blink != newdata.blink)
+              + (olddata.intens != newdata.intens) >= 1
+            &&  (olddata.bg != newdata.bg)
+              + (olddata.fg != newdata.fg) >= 1)
+            {
+                reset_needed = true;
             }
-            else
+
+            if(reset_needed)
             {
+                // '0' resets both blink and intensity flags
                 appint(0);
-                if(TextAttr & 0x100) // 256color tag
-                {
-                    unsigned bg = (TextAttr>>9)&0xFF, fg = TextAttr&0xFF;
-                    if(TextAttr & 0x20000) appint(1);
-                    appcolor(bg, 40,100, "48;5;");
-                    appcolor(fg, 30,90, "38;5;");
-                }
+                OldAttr = DEFAULTATTR; // Presumed default color
+                olddata = { !bool(OldAttr&0x100), BlinkOf(OldAttr), BoldOf(OldAttr),  BackgroundOf(OldAttr), ForegroundOf(OldAttr)};
+            }
+            if(newdata.intens && !olddata.intens) { appint(1); } // Add bold
+            if(newdata.blink  && !olddata.blink)  { appint(5); } // Add blink
+            if(!newdata.intens && olddata.intens) { appint(22); } // Remove bold
+            if(!newdata.blink  && olddata.blink)  { appint(25); } // Remove blink
+            if(newdata.bg != olddata.bg)
+            {
+                // Renew background color
+                if(newdata.legacy)
+                    appint(40 + Swap[newdata.bg]);
                 else
-                {
-                    unsigned bg = (TextAttr>>4)&7, fg = TextAttr&7;
-                    if(TextAttr&0x08) appint(1);
-                    if(TextAttr&0x80) appint(5);
-                    appint(40 + Swap[bg]);
-                    appint(30 + Swap[fg]);
-                }
+                    appcolor(newdata.bg, 40,100, "48;5;");
+            }
+            if(newdata.fg != olddata.fg)
+            {
+                // Renew foreground color
+                if(newdata.legacy)
+                    appint(30 + Swap[newdata.fg]);
+                else
+                    appcolor(newdata.fg, 30,90, "38;5;");
             }
         }
-        Buffer[Buflen++] = 'm';
-        std::fwrite(Buffer,1,Buflen,stdout);
+        else
+        {
+            appint(0);
+            if(TextAttr & 0x100) // 256color tag
+            {
+                unsigned bg = (TextAttr>>9)&0xFF, fg = TextAttr&0xFF;
+                if(TextAttr & 0x20000) appint(1);
+                appcolor(bg, 40,100, "48;5;");
+                appcolor(fg, 30,90, "38;5;");
+            }
+            else
+            {
+                unsigned bg = (TextAttr>>4)&7, fg = TextAttr&7;
+                if(TextAttr&0x08) appint(1);
+                if(TextAttr&0x80) appint(5);
+                appint(40 + Swap[bg]);
+                appint(30 + Swap[fg]);
+            }
+        }
+    }
+    Buffer[Buflen++] = 'm';
+    return Buflen;
+}
+
+/* The escape sequences of recent attribute changes, ready to be copied
+ * into the output. A listing switches between a handful of attributes
+ * several times on each line, so nearly every change is found here.
+ * The table is direct-mapped: a change whose slot is taken by another
+ * replaces it.
+ */
+static struct SGRCacheEntry
+{
+    int  OldAttr = -1, TextAttr = -1;
+    bool AnsiOpt = false;
+    unsigned char Length = 0;
+    char Bytes[32] = {};
+} SGRCache[256];
+#endif
+
+static void FlushSetAttr()
+{
+    if(TextAttr == OldAttr)return;
+    if(Colors)
+    {
+#ifdef DJGPP
+        textattr(TextAttr);
+#else
+        unsigned slot = ((unsigned(OldAttr) * 2654435761u) ^ unsigned(TextAttr) * 40503u) >> 24;
+        SGRCacheEntry& e = SGRCache[slot & 0xFF];
+        if(e.OldAttr != OldAttr || e.TextAttr != TextAttr || e.AnsiOpt != AnsiOpt)
+        {
+            e.OldAttr  = OldAttr;
+            e.TextAttr = TextAttr;
+            e.AnsiOpt  = AnsiOpt;
+            e.Length   = MakeSGR(e.Bytes, OldAttr, TextAttr);
+        }
+        Output.Put(e.Bytes, e.Length);
 #endif
     }
     OldAttr = TextAttr;
@@ -266,28 +372,55 @@ void SetAttr(int newattr)
 }
 
 static int Line;
+static int Spaces=0; // Spaces not yet printed, or backspaces if negative
+
+static void FlushSpaces()
+{
+#ifdef DJGPP
+    while(Spaces < 0) { ++Spaces; (Colors?putch:putchar)('\b'); }
+#else
+    while(Spaces < 0) { ++Spaces; Output.Put('\b'); }
+    static const char spacebuf[16] = {' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' '};
+    if(Spaces >= 5 && AnsiOpt && Colors)
+    {
+        // TODO: Don't do AnsiOpt if background color changed
+        char Buffer[32];
+        Output.Put(Buffer, std::snprintf(Buffer, sizeof Buffer, "\33[%dC", Spaces));
+        Spaces = 0;
+    }
+    else
+    {
+        for(int n; Spaces > 0; Spaces -= n)
+            Output.Put(spacebuf, n = std::min(int(sizeof spacebuf), Spaces));
+    }
+#endif
+}
+
 int Gputch(int x)
 {
     // When background color = foreground color, print only blanks
-    if(BackgroundOf(TextAttr) == ForegroundOf(TextAttr) && x > ' ') x = ' ';
+    if(BlankAttr(TextAttr) && x > ' ') x = ' ';
 
-    // When printing a newline, always do that with default background color
-    if(x=='\n' && BackgroundOf(TextAttr) != 0) GetDescrColor(ColorDescr::TEXT, 1);
+    // Without colors, nothing else depends on the attributes
+    if(Colors)
+    {
+        // When printing a newline, always do that with default background color
+        if(x=='\n' && BackgroundOf(TextAttr) != 0) GetDescrColor(ColorDescr::TEXT, 1);
 
-    // If printing spaces, only change color when the background color changes
-    if(x != ' ' || BackgroundOf(TextAttr) != BackgroundOf(OldAttr))
-        FlushSetAttr();
+        // If printing spaces, only change color when the background color changes
+        if(x != ' ' || BackgroundOf(TextAttr) != BackgroundOf(OldAttr))
+            FlushSetAttr();
+    }
 
     auto put = [](char c)
     {
 #ifdef DJGPP
         (Colors?putch:putchar)(c);
 #else
-        putchar(c);
+        Output.Put(c);
 #endif
     };
 
-    static int Spaces=0;
     switch(x)
     {
         case '\a':
@@ -324,7 +457,7 @@ int Gputch(int x)
                     Gprintf("\r--More--");
                     GetDescrColor(ColorDescr::TEXT, 1);
                     Gprintf(" \b");
-                    fflush(stdout);
+                    Gflush();
                     for(;;)
                     {
                         int Key = Ggetch();
@@ -346,20 +479,10 @@ int Gputch(int x)
         }
         default:
         {
+    #ifdef DJGPP
             while(Spaces < 0) { ++Spaces; put('\b'); }
-    #ifndef DJGPP
-            static const char spacebuf[16] = {' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' '};
-            if(Spaces >= 5 && AnsiOpt && Colors)
-            {
-                // TODO: Don't do AnsiOpt if background color changed
-                std::printf("\33[%dC", Spaces);
-                Spaces = 0;
-            }
-            else
-            {
-                while(Spaces > 0)
-                    Spaces -= std::fwrite(spacebuf, 1, std::min(int(sizeof spacebuf), Spaces), stdout);
-            }
+    #else
+            FlushSpaces();
     #endif
             put(x);
             return x;
@@ -368,6 +491,39 @@ int Gputch(int x)
     return x;
 }
 
+std::size_t Gputs(std::string_view s)
+{
+    for(std::size_t a = 0; a < s.size(); )
+    {
+#ifndef DJGPP
+        // A run of characters that Gputch() would print as they are
+        // is put into the buffer in one go.
+        std::size_t b = a;
+        while(b < s.size() && (unsigned char)s[b] > ' ') ++b;
+        if(b > a && BackgroundOf(TextAttr) != ForegroundOf(TextAttr))
+        {
+            FlushSetAttr();
+            FlushSpaces();
+            Output.Put(s.data() + a, b - a);
+            a = b;
+            continue;
+        }
+#endif
+        Gputch(s[a++]);
+    }
+    return s.size();
+}
+
+void GputsRaw(std::string_view s)
+{
+    FlushSpaces();
+#ifdef DJGPP
+    std::fwrite(s.data(), 1, s.size(), stdout);
+#else
+    Output.Put(s.data(), s.size());
+#endif
+}
+
 int ColorNums = -1;
 
 std::size_t Gwrite(std::string_view s)
@@ -508,19 +664,57 @@ constexpr std::pair<char32_t,char32_t> width_table[] {
     { 0x20000, 0x2fffd },
     { 0x30000, 0x3fffd },
 };
+
+/* At compile time, width_table is made into a two-level lookup table.
+ * The characters are grouped into pages of 256, and each page has
+ * a block of 256 bits. Identical blocks are stored only once, so most
+ * pages share the all-zero block or the all-one block.
+ */
+namespace
+{
+    constexpr char32_t WidthLimit = 0x40000; // Nothing in width_table is above this
+    constexpr unsigned WidthPages = WidthLimit / 256;
+    using WidthBlock = std::array<std::uint32_t, 256/32>;
+
+    constexpr std::array<WidthBlock, WidthPages> width_bitmap = []
+    {
+        std::array<WidthBlock, WidthPages> result{};
+        for(auto [first,last]: width_table)
+            for(char32_t c = first; c <= last; c = (c | 31) + 1)
+            {
+                // Bits from c to the end of the range or of the word
+                unsigned lo = c % 32, hi = std::min<char32_t>(last, c | 31) % 32;
+                result[c / 256][c / 32 % 8] |= (~0u >> (31 - hi)) & (~0u << lo);
+            }
+        return result;
+    }();
+
+    template<unsigned MaxBlocks>
+    struct WidthLookup
+    {
+        unsigned num_blocks = 0;
+        std::array<unsigned char, WidthPages> page{};
+        std::array<WidthBlock, MaxBlocks>     block{};
+
+        constexpr WidthLookup()
+        {
+            for(unsigned p = 0; p < WidthPages; ++p)
+            {
+                unsigned b = 0;
+                while(b < num_blocks && block[b] != width_bitmap[p]) ++b;
+                if(b == num_blocks && num_blocks++ < MaxBlocks) block[b] = width_bitmap[p];
+                page[p] = b;
+            }
+        }
+    };
+    // Built twice: first to count the blocks, then with that many.
+    constexpr WidthLookup<WidthLookup<256>().num_blocks> width_lookup;
+    static_assert(width_lookup.num_blocks <= 256, "Block numbers must fit in a byte");
+}
+
 bool is_doublewide(char32_t c)
 {
-    // find earliest element greater than value
-    auto i = std::upper_bound(std::begin(width_table), std::end(width_table), c,
-                              [](char32_t a, std::pair<char32_t,char32_t> b)
-                              {
-                                  return a < b.first;
-                              });
-    // if the first element is greater, then value is not in any range
-    if(i == std::begin(width_table)) return false;
-    // otherwise i is the earliest greater element, so
-    // go back one to the earliest lesser-or-equal element
-    i--;
-    if(i->second < c) return false;
-    return true;
+    if(c >= WidthLimit) return false;
+    const WidthBlock& b = width_lookup.block[width_lookup.page[c / 256]];
+    return (b[c / 32 % 8] >> (c % 32)) & 1;
 }
@@ -2,6 +2,8 @@
 #define dirr3_cons_hh
 
 #include <algorithm> // std::swap
+#include <cstdint>
+#include <cstring>
 #include "printf.hh"
 #include "config.h"
 
@@ -13,7 +15,11 @@ extern int WhereX;
 extern int LINES, COLS;
 
 extern int Gputch(int x);
+extern std::size_t Gputs(std::string_view s); // Like Gputch() for each character
+extern void GputsRaw(std::string_view s); // The bytes as they are: no colours, paging or '?'
+extern void Gflush(); // Writes out what has been printed
 extern void SetAttr(int newattr);
+extern bool BlankAttr(int attr); // Whether text in this colour is printed as blanks
 extern int ColorNums, TextAttr;
 
 enum { DEFAULTATTR = 7 };
@@ -41,17 +47,15 @@ public:
         std::string str = std::move(p).str();
         int ta = TextAttr, cn = ColorNums >= 0 ? ColorNums : ta;
         std::size_t n = 0;
-        for(char c: str)
-            if(c != '\1') LIKELY
-            {
-                Gputch(c);
-                ++n;
-            }
-            else
-            {
-                SetAttr(cn);
-                std::swap(ta, cn);
-            }
+        for(std::string_view rest = str; ; )
+        {
+            std::size_t run = rest.find('\1');
+            n += Gputs(rest.substr(0, run));
+            if(run == rest.npos) break;
+            rest.remove_prefix(run+1);
+            SetAttr(cn);
+            std::swap(ta, cn);
+        }
         return n;
     }
 };
@@ -130,6 +134,26 @@ inline std::uint_fast64_t ParseUTF8(F&& getchar) // Return value: 32-bits char,
 };
 
 
+/* Returns the number of printable ASCII characters (20..7E)
+ * at the beginning of buf. They are checked eight at a time.
+ */
+inline std::size_t AsciiPrefix(std::string_view buf)
+{
+    constexpr std::uint64_t ones = 0x0101010101010101u;
+    std::size_t n = 0;
+    for(; n+8 <= buf.size(); n += 8)
+    {
+        std::uint64_t x;
+        std::memcpy(&x, buf.data()+n, 8);
+        // The high bit is set in some byte of these, if the byte
+        // is 80..FF, below 20, or 7F (respectively). Borrows only
+        // start from bytes that have already been found bad.
+        if((x | (x - ones*0x20) | ((x ^ ones*0x7F) - ones)) & (ones*0x80)) break;
+    }
+    while(n < buf.size() && (unsigned char)buf[n] >= 0x20 && (unsigned char)buf[n] < 0x7F) ++n;
+    return n;
+}
+
 /* Print maximum of "maxlen" characters from buf.
  * If buf is longer, print spaces.
  * Convert unprintable characters into question marks.
@@ -140,8 +164,17 @@ template<bool print>
 std::size_t WidthPrintHelper(std::size_t maxlen, std::string_view buf, bool fill)
 {
     std::size_t column = 0, bytepos = 0;
-    for(; column<maxlen && bytepos<buf.size(); ++column)
+    while(column<maxlen && bytepos<buf.size())
     {
+        /* Runs of printable ASCII are one column per byte */
+        if(std::size_t run = std::min(AsciiPrefix(buf.substr(bytepos)), maxlen-column); run > 0) LIKELY
+        {
+            if(print) Gputs(buf.substr(bytepos, run));
+            bytepos += run;
+            column  += run;
+            continue;
+        }
+
         /* Detect UTF8 sequence */
         auto utf8 = ParseUTF8([&](unsigned index) -> int
         {
@@ -173,7 +206,7 @@ std::size_t WidthPrintHelper(std::size_t maxlen, std::string_view buf, bool fill
                 else
                     goto invalid_unicode_char;
             }
-            if(length == 1) LIKELY
+            if(length == 1)
             {
                 // Use the code that avoids unprintable characters
                 // Also, no single-byte character is double-wide.
@@ -200,6 +233,7 @@ std::size_t WidthPrintHelper(std::size_t maxlen, std::string_view buf, bool fill
                     Gputch('?');
             }
         }
+        ++column;
     }
     //fprintf(stderr, "Printed %zu bytes: <%.*s>, %zu/%zu columns, fill=%s\n", bytepos, (int)bytepos, buf.data(), column, maxlen, fill?"Y":"N");
     if(fill && column < maxlen)
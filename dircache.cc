@@ -0,0 +1,367 @@
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <initializer_list>
+#include <algorithm>
+
+#include "config.h"
+#include "dircache.hh"
+#include "filters.hh"
+#include "printf.hh"
+
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+
+int DirCache = 0;
+
+/* The cache file: CacheHeader, then for each entry,
+ * CacheEntry followed by the name (not nul-terminated).
+ * The cache is only read by the same build that wrote it,
+ * so the structures are stored as they are in memory.
+ * Of the stat, only what the listing uses is stored.
+ */
+static const char CacheMagic[8] = {'d','i','r','r','C','2','\n','\0'};
+
+struct CacheHeader
+{
+    char     magic[8];
+    uint32_t stat_size;
+    uint32_t fields;   // StatFields when written
+    uint32_t follow;
+    uint32_t dotfiles; // Whether dotfiles were included
+    uint64_t dev, ino;
+    int64_t  mtime, mtime_ns, ctime, ctime_ns;
+    uint64_t count;
+};
+struct CacheEntry
+{
+    uint32_t name_length;
+    int32_t  error;
+    uint32_t mode, nlink, uid, gid;
+    int64_t  size, atime, mtime, ctime;
+    uint64_t dev, rdev, ino;
+};
+
+/* The cache is pruned at most once a day: files not used
+ * in CacheMaxAge are removed, and then the oldest ones, until
+ * the cache takes at most CacheMaxBytes.
+ */
+static const long long   CacheMaxBytes = 64ll << 20;
+static const long long   CacheMaxFileBytes = CacheMaxBytes / 4; // Bigger ones are not saved
+static const std::time_t CacheMaxAge   = 30*24*3600;
+static const std::time_t CachePruneInterval = 24*3600;
+
+/* Anyone could have made the directory in /tmp, so it is only used
+ * if it is a real directory, owned by us and closed to the others.
+ * Otherwise the next candidate is tried.
+ */
+static const std::string& CacheDir()
+{
+    static const std::string result = []
+    {
+        for(const char* path: std::initializer_list<const char*>{getenv("HOME"),getenv("TEMP"),getenv("TMP"),"/tmp"})
+        {
+            if(!path || !*path) continue;
+            std::string dir = std::string(path) + "/.dirr_cache";
+            if(mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) continue;
+            StatType st;
+            if(LStatFunc(dir.c_str(), &st) == 0
+            && S_ISDIR(st.st_mode)
+            && st.st_uid == geteuid()
+            && (st.st_mode & 0777) == 0700)
+                return dir;
+        }
+        return std::string();
+    }();
+    return result;
+}
+
+static void PruneCache()
+{
+    static bool done = false;
+    if(done) return;
+    done = true;
+
+    // The time of the last pruning is the time of this file.
+    std::string stamp = CacheDir() + "/pruned";
+    std::time_t now = std::time(nullptr);
+    StatType st;
+    if(LStatFunc(stamp.c_str(), &st) == 0 && st.st_mtime > now - CachePruneInterval
+    && st.st_mtime <= now) return;
+    int fd = open(stamp.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if(fd < 0) return;
+    futimens(fd, nullptr);
+    close(fd);
+
+    struct CacheFile { std::time_t time; long long size; std::string path; };
+    std::vector<CacheFile> files;
+    long long total = 0;
+    DirReader dir;
+    if(!dir.Open(CacheDir())) return;
+    for(std::string_view name; dir.Next(name); )
+    {
+        if(name.empty() || name[0] == '.' || name == "pruned") continue;
+        std::string path = CacheDir() + '/' + std::string(name);
+        if(LStatFunc(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        // The cache files are read, not written, when they are used.
+        std::time_t time = std::max(st.st_atime, st.st_mtime);
+        if(time < now - CacheMaxAge)
+            { unlink(path.c_str()); continue; }
+        files.push_back({time, (long long)st.st_size, std::move(path)});
+        total += st.st_size;
+    }
+    std::sort(files.begin(), files.end(),
+              [](const CacheFile& a, const CacheFile& b) { return a.time < b.time; });
+    for(std::size_t a = 0; a < files.size() && total > CacheMaxBytes; ++a)
+        if(unlink(files[a].path.c_str()) == 0)
+            total -= files[a].size;
+}
+
+static int DirStat(const DirReader& dir, const std::string& source, StatType* result)
+{
+    if(dir.Fd() >= 0) return fstat(dir.Fd(), result);
+    return StatFunc(source.c_str(), result);
+}
+
+static void MakeHeader(CacheHeader& h, const StatType& st, bool follow, bool dotfiles)
+{
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, CacheMagic, sizeof(h.magic));
+    h.stat_size = sizeof(CacheEntry);
+    h.fields    = StatFields;
+    h.follow    = follow;
+    h.dotfiles  = dotfiles;
+    h.dev       = st.st_dev;
+    h.ino       = st.st_ino;
+    h.mtime     = st.st_mtim.tv_sec;
+    h.mtime_ns  = st.st_mtim.tv_nsec;
+    h.ctime     = st.st_ctim.tv_sec;
+    h.ctime_ns  = st.st_ctim.tv_nsec;
+}
+
+static bool ReadHeader(const std::vector<char>& data, CacheHeader& h)
+{
+    if(data.size() < sizeof(h)) return false;
+    std::memcpy(&h, &data[0], sizeof(h));
+    return true;
+}
+
+// Whether "got" describes the same directory in the same state as "want".
+static bool HeaderMatches(const CacheHeader& got, const CacheHeader& want)
+{
+    return std::memcmp(got.magic, want.magic, sizeof(got.magic)) == 0
+        && got.stat_size == want.stat_size
+        && got.follow    == want.follow
+        && (got.dotfiles || !want.dotfiles)
+        && got.dev == want.dev && got.ino == want.ino
+        && got.mtime == want.mtime && got.mtime_ns == want.mtime_ns
+        && got.ctime == want.ctime && got.ctime_ns == want.ctime_ns;
+}
+
+static bool ReadFile(const std::string& fn, std::vector<char>& data)
+{
+    int fd = open(fn.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+    StatType st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size <= CacheMaxFileBytes;
+    if(ok)
+    {
+        data.resize(st.st_size);
+        std::size_t pos = 0;
+        while(ok && pos < data.size())
+        {
+            ssize_t r = read(fd, &data[pos], data.size() - pos);
+            if(r < 0 && errno == EINTR) continue;
+            if(r <= 0) ok = false; else pos += r;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static bool WriteAll(int fd, const char* data, std::size_t size, off_t offset)
+{
+    for(std::size_t pos = 0; pos < size; )
+    {
+        ssize_t r = pwrite(fd, data + pos, size - pos, offset + pos);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return false;
+        pos += r;
+    }
+    return true;
+}
+
+/* CacheWriter: Writes the cache file while the directory is read,
+ * so that the listing is not kept in memory twice. It is written
+ * into a temporary file first, so that another instance of dirr
+ * never sees a partially written file. The header goes in last.
+ */
+class CacheWriter
+{
+    std::string tmp{};
+    int fd = -1;
+    off_t written = sizeof(CacheHeader);
+    std::vector<char> buffer{};
+    static constexpr std::size_t BufferSize = 64*1024;
+
+    bool Flush()
+    {
+        if(fd < 0) return false;
+        if(written + (off_t)buffer.size() > CacheMaxFileBytes
+        || !WriteAll(fd, buffer.data(), buffer.size(), written))
+            { Abandon(); return false; }
+        written += buffer.size();
+        buffer.clear();
+        return true;
+    }
+public:
+    explicit CacheWriter(const std::string& fn) : tmp(fn + ".XXXXXX")
+    {
+        fd = mkstemp(&tmp[0]);
+        buffer.reserve(BufferSize);
+    }
+    ~CacheWriter() { Abandon(); }
+    CacheWriter(const CacheWriter&) = delete;
+    CacheWriter& operator=(const CacheWriter&) = delete;
+
+    void Add(const StatRequest& r)
+    {
+        if(fd < 0) return;
+        CacheEntry e;
+        std::memset(&e, 0, sizeof(e));
+        e.name_length = r.Name.size();
+        e.error = r.Error;
+        e.mode  = r.Stat.st_mode;  e.nlink = r.Stat.st_nlink;
+        e.uid   = r.Stat.st_uid;   e.gid   = r.Stat.st_gid;
+        e.size  = r.Stat.st_size;
+        e.atime = r.Stat.st_atime; e.mtime = r.Stat.st_mtime; e.ctime = r.Stat.st_ctime;
+        e.dev   = r.Stat.st_dev;   e.rdev  = r.Stat.st_rdev;  e.ino   = r.Stat.st_ino;
+        const char* p = (const char*)&e;
+        buffer.insert(buffer.end(), p, p + sizeof(e));
+        buffer.insert(buffer.end(), r.Name.begin(), r.Name.end());
+        if(buffer.size() >= BufferSize) Flush();
+    }
+    // Abandon: Drops what has been written.
+    void Abandon()
+    {
+        if(fd < 0) return;
+        close(fd);
+        unlink(tmp.c_str());
+        fd = -1;
+    }
+    void Finish(const std::string& fn, const CacheHeader& header)
+    {
+        if(!Flush()) return;
+        bool ok = WriteAll(fd, (const char*)&header, sizeof(header), 0);
+        if(close(fd) != 0) ok = false;
+        fd = -1;
+        if(!ok || rename(tmp.c_str(), fn.c_str()) != 0)
+            unlink(tmp.c_str());
+    }
+};
+
+static void Restore(const CacheEntry& e, StatType& st)
+{
+    std::memset(&st, 0, sizeof(st));
+    st.st_mode  = e.mode;  st.st_nlink = e.nlink;
+    st.st_uid   = e.uid;   st.st_gid   = e.gid;
+    st.st_size  = e.size;
+    st.st_atime = e.atime; st.st_mtime = e.mtime; st.st_ctime = e.ctime;
+    st.st_dev   = e.dev;   st.st_rdev  = e.rdev;  st.st_ino   = e.ino;
+}
+
+void ScanCached(DirReader& dir, const std::string& source, bool dotfiles, bool follow,
+                NameArena& names,
+                const std::function<void(std::vector<StatRequest>&)>& handle)
+{
+    StatType dirstat;
+    if(!DirCache || CacheDir().empty() || DirStat(dir, source, &dirstat) != 0)
+    {
+        ScanEntries(dir, source, dotfiles, follow, names, handle);
+        return;
+    }
+
+    std::string fn = CacheDir() + Printf("/%llx-%llx",
+                                         (unsigned long long)dirstat.st_dev,
+                                         (unsigned long long)dirstat.st_ino);
+    CacheHeader want, got;
+    MakeHeader(want, dirstat, follow, dotfiles);
+
+    std::vector<char> data;
+    if(ReadFile(fn, data) && ReadHeader(data, got) && HeaderMatches(got, want))
+    {
+        // The names are known for certain, because adding, removing
+        // or renaming files changes the times of the directory.
+        // If nothing but the file type is needed, that is known too.
+        bool trust = (DirCache >= 2 || StatFields == 0)
+                  && !(StatFields & ~got.fields);
+
+        std::string path = source;
+        if(path.back() != '/') path += '/';
+
+        std::vector<StatRequest> batch;
+        auto flush = [&]
+        {
+            if(!trust) StatBatch(dir.Fd(), batch.data(), batch.size(), follow);
+            handle(batch);
+            batch.clear();
+        };
+        std::size_t pos = sizeof(got);
+        for(uint64_t n = 0; n < got.count; ++n)
+        {
+            CacheEntry e;
+            if(data.size() - pos < sizeof(e)) break;
+            std::memcpy(&e, &data[pos], sizeof(e));
+            pos += sizeof(e);
+            if(data.size() - pos < e.name_length) break;
+            std::string_view name(&data[pos], e.name_length);
+            pos += e.name_length;
+
+            if(name.empty() || (!dotfiles && name[0] == '.')) continue;
+            if(!(S_ISDIR(e.mode) && StatFilter.SubdirsNeeded)
+            && !NameFilterPasses(name)) continue;
+
+            auto [d, stored] = names.Add(path, name);
+            batch.push_back({d, stored, {}, e.error});
+            Restore(e, batch.back().Stat);
+            if(batch.size() >= StatBatchSize) flush();
+        }
+        flush();
+        return;
+    }
+
+    // Not in the cache. Read the directory, and remember what was found.
+    // A filtered listing is not complete, so it is not saved.
+    // (The type filter is tested before the stat.)
+    if(NameFiltersUsed || StatFiltersUsed)
+    {
+        ScanEntries(dir, source, dotfiles, follow, names, handle);
+        return;
+    }
+    std::vector<char>().swap(data);
+    CacheWriter writer(fn);
+    ScanEntries(dir, source, dotfiles, follow, names, [&](std::vector<StatRequest>& batch)
+    {
+        for(const StatRequest& r: batch)
+            writer.Add(r);
+        want.count += batch.size();
+        handle(batch);
+    });
+
+    // If the directory was changed during the scan, or so recently
+    // that it could still change within the same timestamp, do not save.
+    StatType after;
+    if(DirStat(dir, source, &after) != 0) return;
+    MakeHeader(got, after, follow, dotfiles);
+    if(!HeaderMatches(want, got)) return;
+    std::time_t now = std::time(nullptr);
+    if(after.st_mtime >= now - 1 || after.st_ctime >= now - 1) return;
+
+    PruneCache();
+    writer.Finish(fn, want);
+}
@@ -0,0 +1,41 @@
+#ifndef dirr3_dircache_hh
+#define dirr3_dircache_hh
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "config.h"
+#include "dirscan.hh"
+
+/***********************************************
+ *
+ * ScanCached(dir, source, dotfiles, follow, names, handle)
+ *
+ *   Like ScanEntries(), but with DirCache enabled, remembers
+ *   the listing in a file under ~/.dirr_cache (next to ~/.dirr_dfa).
+ *   The file is keyed by the device and inode number of the directory,
+ *   and it is used only while the modification and change times
+ *   of the directory are still the same. The directory must be owned
+ *   by the user and have mode 0700, and once a day, files not used in
+ *   30 days are removed, and the oldest ones while it takes over 64 MiB.
+ *   The file is written while the directory is read. Listings that
+ *   would take over 16 MiB in it are not saved.
+ *
+ *     DirCache = 0: Not used (default).
+ *     DirCache = 1: The names are taken from the cache, but the
+ *                   files are still stat'ed. The output is always
+ *                   the same as without the cache.
+ *     DirCache = 2: The stat results are taken from the cache, too.
+ *                   Writing into a file does not change the time of
+ *                   its directory, so sizes and times may be outdated.
+ *
+ **********************************************************/
+
+extern int DirCache;
+
+extern void ScanCached(DirReader& dir, const std::string& source, bool dotfiles, bool follow,
+                       NameArena& names,
+                       const std::function<void(std::vector<StatRequest>&)>& handle);
+
+#endif
@@ -0,0 +1,611 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#include "config.h"
+#include "dirscan.hh"
+#include "filters.hh"
+
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_STATX
+# include <sys/sysmacros.h> // makedev
+#endif
+#ifdef HAVE_STD_THREAD
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <atomic>
+# include <memory>
+#endif
+#if defined(HAVE_IO_URING_STATX) && defined(HAVE_STATX)
+# define USE_IO_URING
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# include <sys/mman.h>
+# include <cstring>
+# include <cstdint>
+# include <memory>
+#endif
+
+#ifdef HAVE_READDIR_DIR_H
+# include <dir.h>
+#endif
+#ifdef HAVE_READDIR_DIRENT_H
+# include <dirent.h>
+#endif
+#ifdef HAVE_READDIR_DIRECT_H
+# include <direct.h>
+#endif
+
+#ifdef HAVE_GETDENTS64
+/* The kernel fills as much of the buffer as it can in one call,
+ * so a big buffer means few system calls for big directories.
+ */
+static const std::size_t GetdentsBufferSize = 256*1024;
+#endif
+
+/* Converts d_type into the S_IFMT bits of st_mode. */
+template<typename Dirent>
+static unsigned TypeOf(const Dirent* ent)
+{
+#if defined(DT_UNKNOWN) && (defined(HAVE_GETDENTS64) || defined(_DIRENT_HAVE_D_TYPE))
+    switch(ent->d_type)
+    {
+        case DT_DIR:  return S_IFDIR;
+        case DT_REG:  return S_IFREG;
+        case DT_CHR:  return S_IFCHR;
+        case DT_BLK:  return S_IFBLK;
+# ifdef S_ISLNK
+        case DT_LNK:  return S_IFLNK;
+# endif
+# ifdef S_ISFIFO
+        case DT_FIFO: return S_IFIFO;
+# endif
+# ifdef S_ISSOCK
+        case DT_SOCK: return S_IFSOCK;
+# endif
+    }
+#else
+    (void)ent;
+#endif
+    return 0;
+}
+
+bool DirReader::Open(const std::string& path)
+{
+    Close();
+#ifdef HAVE_GETDENTS64
+    fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) return false;
+    buffer.resize(GetdentsBufferSize);
+    pos = length = 0;
+    return true;
+#else
+    DIR* d = opendir(path.c_str());
+    if(!d) return false;
+    dir = d;
+  #ifdef HAVE_FSTATAT
+    fd = dirfd(d);
+  #endif
+    return true;
+#endif
+}
+
+bool DirReader::Next(std::string_view& name)
+{
+#ifdef HAVE_GETDENTS64
+    if(pos >= length)
+    {
+        ssize_t r;
+        do r = getdents64(fd, &buffer[0], buffer.size());
+        while(r < 0 && errno == EINTR);
+        if(r <= 0) { if(r == 0) errno = 0; return false; }
+        pos = 0;
+        length = r;
+    }
+    const struct dirent64* ent = (const struct dirent64*)&buffer[pos];
+    pos += ent->d_reclen;
+    name = ent->d_name;
+    type = TypeOf(ent);
+    ino  = ent->d_ino;
+    return true;
+#else
+    errno = 0;
+    const struct dirent* ent = readdir((DIR*)dir);
+    if(!ent) return false;
+    name = ent->d_name;
+    type = TypeOf(ent);
+    ino  = ent->d_ino;
+    return true;
+#endif
+}
+
+int DirReader::Close()
+{
+    int result = 0;
+#ifdef HAVE_GETDENTS64
+    if(fd >= 0) result = close(fd);
+#else
+    if(dir) result = closedir((DIR*)dir);
+    dir = nullptr;
+#endif
+    fd = -1;
+    return result;
+}
+
+unsigned StatFields = StatFieldAll;
+
+#ifdef HAVE_STATX
+static unsigned StatxMask(unsigned fields)
+{
+    unsigned mask = STATX_TYPE;
+    if(fields & (StatFieldMode|StatFieldExec)) mask |= STATX_MODE;
+    if(fields & StatFieldNlink)  mask |= STATX_NLINK;
+    if(fields & StatFieldUid)    mask |= STATX_UID;
+    if(fields & StatFieldGid)    mask |= STATX_GID;
+    if(fields & StatFieldAtime)  mask |= STATX_ATIME;
+    if(fields & StatFieldMtime)  mask |= STATX_MTIME;
+    if(fields & StatFieldCtime)  mask |= STATX_CTIME;
+    if(fields & StatFieldIno)    mask |= STATX_INO;
+    if(fields & StatFieldSize)   mask |= STATX_SIZE;
+    if(fields & StatFieldBlocks) mask |= STATX_BLOCKS;
+    return mask;
+}
+
+static void StatxToStat(const struct statx& x, StatType* result)
+{
+    *result = {};
+    result->st_dev   = makedev(x.stx_dev_major, x.stx_dev_minor);
+    result->st_rdev  = makedev(x.stx_rdev_major, x.stx_rdev_minor);
+    result->st_ino   = x.stx_ino;
+    result->st_mode  = x.stx_mode;
+    result->st_nlink = x.stx_nlink;
+    result->st_uid   = x.stx_uid;
+    result->st_gid   = x.stx_gid;
+    result->st_size  = x.stx_size;
+    result->st_blksize = x.stx_blksize;
+    result->st_blocks  = x.stx_blocks;
+    result->st_atim.tv_sec = x.stx_atime.tv_sec; result->st_atim.tv_nsec = x.stx_atime.tv_nsec;
+    result->st_mtim.tv_sec = x.stx_mtime.tv_sec; result->st_mtim.tv_nsec = x.stx_mtime.tv_nsec;
+    result->st_ctim.tv_sec = x.stx_ctime.tv_sec; result->st_ctim.tv_nsec = x.stx_ctime.tv_nsec;
+}
+
+// Cleared if the kernel turns out not to support statx().
+#ifdef HAVE_STD_THREAD
+static std::atomic<bool> UseStatx{true};
+#else
+static bool UseStatx = true;
+#endif
+#endif
+
+int StatAt(int dirfd, std::string_view dir, const char* name,
+           StatType* result, bool follow)
+{
+    // Without a directory descriptor, the kernel needs the whole path
+    std::string path;
+#ifdef HAVE_FSTATAT
+    if(dirfd < 0 && !dir.empty())
+#else
+    if(!dir.empty())
+#endif
+    {
+        path.reserve(dir.size() + std::strlen(name));
+        path.assign(dir);
+        path += name;
+        name = path.c_str();
+    }
+    if(dirfd < 0) dirfd = AT_FDCWD;
+#ifdef HAVE_STATX
+    if(UseStatx)
+    {
+        struct statx x;
+        int r = statx(dirfd, name,
+                      follow ? 0 : AT_SYMLINK_NOFOLLOW, StatxMask(StatFields), &x);
+        if(r == 0) { StatxToStat(x, result); return 0; }
+        if(errno != ENOSYS) return r;
+        UseStatx = false;
+    }
+#endif
+#ifdef HAVE_FSTATAT
+    return StatAtFunc(dirfd, name, result, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+#else
+    (void)dirfd;
+    return follow ? StatFunc(name, result)
+                  : LStatFunc(name, result);
+#endif
+}
+
+#ifdef USE_IO_URING
+/* A minimal io_uring, used through the raw system calls,
+ * for submitting IORING_OP_STATX requests.
+ */
+class StatRing
+{
+    int fd = -1;
+    unsigned entries = 0;
+    void*  sq_ptr = MAP_FAILED; std::size_t sq_size = 0;
+    void*  cq_ptr = MAP_FAILED; std::size_t cq_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED; std::size_t sqes_size = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    std::vector<struct statx> buffers{};
+public:
+    StatRing() {}
+    StatRing(const StatRing&) = delete;
+    StatRing& operator=(const StatRing&) = delete;
+    ~StatRing()
+    {
+        if(sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if(sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+        if(fd >= 0) close(fd);
+    }
+
+    bool Init(unsigned depth)
+    {
+        io_uring_params p{};
+        fd = syscall(__NR_io_uring_setup, depth, &p);
+        if(fd < 0) return false;
+        if(!(p.features & IORING_FEAT_SINGLE_MMAP)) return false;
+
+        entries = p.sq_entries;
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes  + p.cq_entries * sizeof(io_uring_cqe);
+        sq_size = cq_size = std::max(sq_size, cq_size);
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(sq_ptr == MAP_FAILED) return false;
+        cq_ptr = sq_ptr;
+
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(sqes == MAP_FAILED) return false;
+
+        char* sq = (char*)sq_ptr;
+        sq_head  = (unsigned*)(sq + p.sq_off.head);
+        sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        char* cq = (char*)cq_ptr;
+        cq_head  = (unsigned*)(cq + p.cq_off.head);
+        cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes     = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+        // The kernel may know io_uring, but not IORING_OP_STATX
+        const unsigned num_ops = 256;
+        std::vector<char> space(sizeof(io_uring_probe) + num_ops * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = (io_uring_probe*)space.data();
+        if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, num_ops) < 0
+        || probe->last_op < IORING_OP_STATX
+        || !(probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED))
+            return false;
+
+        buffers.resize(entries);
+        return true;
+    }
+
+    /* Runs the requests, keeping up to "entries" of them in flight.
+     * Returns false if the ring stopped working. Then the requests
+     * that were not done have Error = -1, and the ring should not be
+     * used again. It still waits for those that the kernel took,
+     * because they refer to the names and to the buffers.
+     */
+    bool Run(int dirfd, StatRequest* requests, std::size_t count, bool follow)
+    {
+        unsigned mask  = StatxMask(StatFields);
+        int      flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+
+        // Free slots in "buffers", one per request in flight
+        std::vector<unsigned> free_slots(entries);
+        for(unsigned n=0; n<entries; ++n) free_slots[n] = entries-1-n;
+
+        std::size_t next = 0, done = 0;
+        auto reap = [&]
+        {
+            unsigned head = *cq_head, reaped = 0;
+            while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = cqes[head & *cq_mask];
+                std::size_t which = cqe.user_data >> 32;
+                unsigned    slot  = cqe.user_data & 0xFFFFFFFFu;
+                StatRequest& r = requests[which];
+                if(cqe.res == 0)
+                {
+                    StatxToStat(buffers[slot], &r.Stat);
+                    r.Error = 0;
+                }
+                else
+                    r.Error = -cqe.res;
+                free_slots.push_back(slot);
+                ++head;
+                ++reaped;
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            done += reaped;
+            return reaped;
+        };
+
+        while(done < count)
+        {
+            unsigned tail = *sq_tail;
+            while(next < count && !free_slots.empty())
+            {
+                unsigned slot = free_slots.back(); free_slots.pop_back();
+                unsigned index = tail & *sq_mask;
+                io_uring_sqe* sqe = &sqes[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode      = IORING_OP_STATX;
+                sqe->fd          = dirfd;
+                sqe->addr        = (std::uintptr_t)requests[next].Name.data();
+                sqe->len         = mask;
+                sqe->off         = (std::uintptr_t)&buffers[slot];
+                sqe->statx_flags = flags;
+                sqe->user_data   = (std::uint64_t(next) << 32) | slot;
+                sq_array[index]  = index;
+                ++tail;
+                ++next;
+            }
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+            for(;;)
+            {
+                unsigned to_submit = tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+                if(syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0)
+                    break;
+                if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                {
+                    // The ring is unusable. The caller does the rest synchronously,
+                    // once the requests that the kernel took have completed.
+                    // Those still in the submission queue are never run.
+                    std::size_t taken = next - (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+                    while(done < taken)
+                        if(!reap()
+                        && syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                        && errno != EINTR)
+                            usleep(1000);
+                    return false;
+                }
+            }
+            reap();
+        }
+        return true;
+    }
+};
+
+/* How many stat requests to keep in flight */
+static const unsigned StatRingDepth = 256;
+#endif
+
+unsigned StatJobs = 1;
+bool UseStatRing = false;
+
+#ifdef HAVE_STD_THREAD
+/* A pool of threads that do StatAt() calls. Each thread takes
+ * a few requests at a time from the batch and writes the results
+ * into those requests, so the order of the batch is not changed.
+ */
+class StatPool
+{
+    std::vector<std::thread> threads{};
+    std::mutex lock{};
+    std::condition_variable wake{}, finished{};
+    unsigned generation = 0, active = 0;
+    bool quit = false;
+
+    // The batch being worked on
+    int dirfd = AT_FDCWD;
+    bool follow = false;
+    StatRequest* requests = nullptr;
+    std::size_t count = 0;
+    std::atomic<std::size_t> next{0};
+
+    static const std::size_t Chunk = 16;
+
+    void Work()
+    {
+        for(;;)
+        {
+            std::size_t begin = next.fetch_add(Chunk, std::memory_order_relaxed);
+            if(begin >= count) break;
+            std::size_t end = std::min(begin + Chunk, count);
+            for(std::size_t n = begin; n < end; ++n)
+            {
+                StatRequest& r = requests[n];
+                r.Error = StatAt(dirfd, *r.Dir, r.Name.data(), &r.Stat, follow) == 0 ? 0 : errno;
+            }
+        }
+    }
+    void Worker()
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        for(unsigned seen = generation; ; )
+        {
+            wake.wait(lk, [&]{ return quit || generation != seen; });
+            if(quit) return;
+            seen = generation;
+            ++active;
+            lk.unlock();
+            Work();
+            lk.lock();
+            if(--active == 0) finished.notify_all();
+        }
+    }
+public:
+    explicit StatPool(unsigned num_threads)
+    {
+        // The calling thread works too, so start one less
+        for(unsigned n=1; n<num_threads; ++n)
+            threads.emplace_back(&StatPool::Worker, this);
+    }
+    ~StatPool()
+    {
+        { std::lock_guard<std::mutex> lk(lock); quit = true; }
+        wake.notify_all();
+        for(auto& t: threads) t.join();
+    }
+    StatPool(const StatPool&) = delete;
+    StatPool& operator=(const StatPool&) = delete;
+
+    void Run(int fd, StatRequest* reqs, std::size_t num, bool follow_links)
+    {
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            // A thread may still be finishing the previous batch
+            finished.wait(lk, [&]{ return active == 0; });
+            dirfd = fd;
+            follow = follow_links;
+            requests = reqs;
+            count = num;
+            next.store(0, std::memory_order_relaxed);
+            ++generation;
+        }
+        wake.notify_all();
+        Work();
+        std::unique_lock<std::mutex> lk(lock);
+        finished.wait(lk, [&]{ return active == 0; });
+    }
+};
+#endif
+
+void StatBatch(int dirfd, StatRequest* requests, std::size_t count, bool follow)
+{
+#ifdef HAVE_STD_THREAD
+    if(StatJobs > 1 && count > 1)
+    {
+        // The pool serves one batch at a time. If another thread
+        // is already using it, do this batch in the other ways.
+        static std::mutex pool_user;
+        static std::unique_ptr<StatPool> pool;
+        std::unique_lock<std::mutex> lk(pool_user, std::try_to_lock);
+        if(lk.owns_lock())
+        {
+            if(!pool) pool = std::make_unique<StatPool>(StatJobs);
+            pool->Run(dirfd, requests, count, follow);
+            return;
+        }
+    }
+#endif
+#ifdef USE_IO_URING
+    // One ring per thread, created when first needed.
+    // If io_uring turns out to be unavailable, it is not tried again.
+    static thread_local std::unique_ptr<StatRing> ring;
+    static thread_local bool ring_failed = false;
+    // The ring is given the names alone, relative to dirfd.
+    if(UseStatRing && count > 1 && dirfd >= 0 && !ring_failed && UseStatx)
+    {
+        if(!ring)
+        {
+            ring = std::make_unique<StatRing>();
+            if(!ring->Init(StatRingDepth)) { ring.reset(); ring_failed = true; }
+        }
+        if(ring)
+        {
+            for(std::size_t n=0; n<count; ++n) requests[n].Error = -1;
+            // A ring that stopped working is replaced in the next batch.
+            if(!ring->Run(dirfd, requests, count, follow))
+                ring.reset();
+            // Redo the ones that did not complete, and in case
+            // the ring treated some flags differently, the EINVALs.
+            for(std::size_t n=0; n<count; ++n)
+                if(requests[n].Error == -1 || requests[n].Error == EINVAL)
+                    requests[n].Error = StatAt(dirfd, *requests[n].Dir, requests[n].Name.data(),
+                                               &requests[n].Stat, follow) == 0 ? 0 : errno;
+            return;
+        }
+    }
+#endif
+    for(std::size_t n=0; n<count; ++n)
+    {
+        StatRequest& r = requests[n];
+        r.Error = StatAt(dirfd, *r.Dir, r.Name.data(), &r.Stat, follow) == 0 ? 0 : errno;
+    }
+}
+
+void ScanEntries(DirReader& dir, const std::string& source, bool dotfiles, bool follow,
+                 NameArena& names,
+                 const std::function<void(std::vector<StatRequest>&)>& handle)
+{
+    // If nothing but the type is needed, the directory can tell it.
+    // With StatFieldExec, directories and symlinks still need nothing more.
+    bool type_only = !(StatFields & ~(StatFieldExec));
+    bool type_is_enough = type_only && !(StatFields & StatFieldExec);
+
+    std::vector<StatRequest> batch, unknown;
+    std::vector<std::pair<ino_t, std::size_t>> order; // Those that need a stat
+    auto flush = [&]
+    {
+        // Stat them in the order of inode numbers. On most filesystems,
+        // the inodes are stored in that order, so the disk does not need
+        // to jump back and forth. The results are still handled in the
+        // order the entries were read.
+        std::sort(order.begin(), order.end());
+        for(std::size_t begin = 0; begin < order.size(); begin += StatBatchSize)
+        {
+            std::size_t end = std::min(begin + StatBatchSize, order.size());
+            for(std::size_t n = begin; n < end; ++n) unknown.push_back(std::move(batch[order[n].second]));
+            StatBatch(dir.Fd(), unknown.data(), unknown.size(), follow);
+            for(std::size_t n = begin; n < end; ++n) batch[order[n].second] = std::move(unknown[n-begin]);
+            unknown.clear();
+        }
+        handle(batch);
+        batch.clear();
+        order.clear();
+    };
+
+    std::string path = source;
+    if(path.back() != '/') path += '/';
+
+    std::string_view name;
+    while(dir.Next(name))
+    {
+        if(!dotfiles && name[0] == '.') continue;
+
+        // The type filter can be tested already. But directories
+        // are still needed with -R, and followed symlinks may turn
+        // out to be anything. With -R, what may be a directory is
+        // kept even if the name filters reject it; DirTree enters
+        // it but does not list it.
+        unsigned dtype = dir.Type();
+        bool maybe_dir = dtype == 0 || dtype == S_IFDIR;
+#ifdef S_ISLNK
+        if(dtype == S_IFLNK && follow) maybe_dir = true;
+#endif
+        if(!(maybe_dir && StatFilter.SubdirsNeeded) && !NameFilterPasses(name)) continue;
+
+        if(dtype && !(dtype == S_IFDIR && StatFilter.SubdirsNeeded) && !TypeFilterPasses(dtype)
+#ifdef S_ISLNK
+        && !(dtype == S_IFLNK && follow)
+#endif
+          ) continue;
+
+        auto [d, n] = names.Add(path, name);
+        batch.push_back({d, n});
+
+        unsigned type = type_only ? dtype : 0;
+        bool known = false;
+        switch(type)
+        {
+            case 0: break;
+            case S_IFDIR: known = true; break;
+#ifdef S_ISLNK
+            case S_IFLNK: known = !follow; break; // Followed with -l0 only
+#endif
+            default: known = type_is_enough;
+        }
+        if(known)
+        {
+            batch.back().Stat.st_mode = type;
+            batch.back().Stat.st_ino  = dir.Ino();
+        }
+        else
+            order.emplace_back(dir.Ino(), batch.size()-1);
+        if(batch.size() >= ScanWindowSize) flush();
+    }
+    flush();
+}
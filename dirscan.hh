@@ -0,0 +1,170 @@
+#ifndef dirr3_dirscan_hh
+#define dirr3_dirscan_hh
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+#include "config.h"
+#include "stat.h"
+#include "namearena.hh"
+
+#ifdef HAVE_FSTATAT_SYS_STAT_H
+# include <fcntl.h>
+#endif
+#ifndef AT_FDCWD
+# define AT_FDCWD -100
+#endif
+
+/***********************************************
+ *
+ * DirReader
+ *
+ *   Reads the entries of a directory through a directory
+ *   file descriptor. Where getdents64() is available, the
+ *   entries are read in large batches with it, otherwise
+ *   readdir() is used.
+ *
+ *     Open(path): Opens the directory. Returns false and
+ *                 sets errno (like opendir()) on failure.
+ *     Next(name): Retrieves the next entry. Returns false
+ *                 at the end of directory or on error.
+ *     Type():     The file type (S_IFDIR etc.) of that entry, as told
+ *                 by the directory itself. 0 if it did not tell.
+ *     Ino():      The inode number of that entry.
+ *     Fd():       The directory descriptor, for StatAt().
+ *     Close():    Returns 0, or -1 with errno (like closedir()).
+ *
+ **********************************************************/
+
+class DirReader
+{
+    int fd = -1;
+    void* dir = nullptr;          // DIR*, when getdents64 is not used
+    std::vector<char> buffer{};
+    std::size_t pos = 0, length = 0;
+    unsigned type = 0;
+    ino_t ino = 0;
+public:
+    DirReader() {}
+    ~DirReader() { Close(); }
+    DirReader(const DirReader&) = delete;
+    DirReader& operator=(const DirReader&) = delete;
+
+    bool Open(const std::string& path);
+    bool Next(std::string_view& name);
+    int Fd() const { return fd; }
+    unsigned Type() const { return type; }
+    ino_t Ino() const { return ino; }
+    int Close();
+};
+
+/* The fields of StatType that the listing needs.
+ * Where statx() is available, StatAt() only asks the
+ * kernel for these fields. The rest may be left unfilled.
+ * The file type, st_dev and st_rdev are always filled.
+ */
+enum StatField: unsigned
+{
+    StatFieldMode   = 0x001, // The permission bits of st_mode
+    StatFieldNlink  = 0x002,
+    StatFieldUid    = 0x004,
+    StatFieldGid    = 0x008,
+    StatFieldAtime  = 0x010,
+    StatFieldMtime  = 0x020,
+    StatFieldCtime  = 0x040,
+    StatFieldIno    = 0x080,
+    StatFieldSize   = 0x100,
+    StatFieldBlocks = 0x200,
+    StatFieldExec   = 0x400, // StatFieldMode, but not for directories or symlinks
+    StatFieldAll    = 0x7FF
+};
+extern unsigned StatFields;
+
+/***********************************************
+ *
+ * StatAt(dirfd, dir, name, result, follow)
+ *
+ *   Stats the file dir+name. If dirfd refers to the directory
+ *   "dir", only "name" is given to the kernel, and the directory
+ *   is not looked up again. With dirfd = AT_FDCWD, the whole path
+ *   is put together, unless dir is empty and name is the path.
+ *
+ *     follow: true = stat(), false = lstat()
+ *
+ *   Return value: 0 on success, -1 with errno on failure.
+ *
+ **********************************************************/
+
+extern int StatAt(int dirfd, std::string_view dir, const char* name,
+                  StatType* result, bool follow);
+
+/***********************************************
+ *
+ * StatBatch(dirfd, requests, count, follow)
+ *
+ *   Does StatAt() for each of the requests, which all are
+ *   in the directory dirfd. With StatJobs > 1, they are divided
+ *   among that many threads. Otherwise, with UseStatRing, where
+ *   io_uring is available, all of them are submitted to the kernel
+ *   at once, and they are waited for together. Otherwise, they are
+ *   done one by one.
+ *
+ *   Each request gets either Stat filled and Error = 0,
+ *   or Error set to the errno value.
+ *
+ **********************************************************/
+
+struct StatRequest
+{
+    const std::string* Dir;  // Up to and including the last slash
+    std::string_view   Name; // In a NameArena, so followed by a nul byte
+    StatType    Stat{};
+    int         Error = 0;
+
+    std::string Path() const { std::string p(*Dir); p += Name; return p; }
+};
+
+extern unsigned StatJobs;
+extern bool UseStatRing;
+extern void StatBatch(int dirfd, StatRequest* requests, std::size_t count, bool follow);
+
+/***********************************************
+ *
+ * ScanEntries(dir, source, dotfiles, follow, names, handle)
+ *
+ *   Reads the entries of the opened directory "dir", and
+ *   stats them with StatBatch() in batches of StatBatchSize.
+ *   Up to ScanWindowSize entries are read before any of them are
+ *   stat'ed. They are then stat'ed in the order of inode numbers.
+ *
+ *   When StatFields asks for nothing but the file type, and
+ *   the directory tells the type of the entry, the entry is
+ *   not stat'ed. Its Stat then has only st_mode and st_ino.
+ *
+ *     source:   Path of the directory. Each entry gets
+ *               source + '/' as its Dir.
+ *     names:    Where the names of the entries are stored. The caller
+ *               may clear it in handle(), if it keeps none of them.
+ *     dotfiles: If false, names beginning with '.' are skipped.
+ *               So are names that NameFilterPasses() rejects,
+ *               except directories when StatFilter.SubdirsNeeded.
+ *     follow:   Whether symlinks are stat'ed through. The listing
+ *               does that only with -l0. With -l3 and -l5, the links
+ *               themselves are stat'ed, and the target is stat'ed
+ *               separately when the link is printed.
+ *     handle:   Gets up to ScanWindowSize entries at a time,
+ *               in the order the entries were read.
+ *               It may move the contents out of the batch.
+ *
+ **********************************************************/
+
+static const std::size_t StatBatchSize = 4096;
+static const std::size_t ScanWindowSize = 65536;
+
+extern void ScanEntries(DirReader& dir, const std::string& source, bool dotfiles, bool follow,
+                        NameArena& names,
+                        const std::function<void(std::vector<StatRequest>&)>& handle);
+
+#endif
@@ -0,0 +1,293 @@
+#include <cerrno>
+#include <algorithm>
+#include <deque>
+
+#include "config.h"
+#include "dirtree.hh"
+#include "dircache.hh"
+#include "filters.hh"
+
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#include <unistd.h>
+
+#ifdef HAVE_STD_THREAD
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+#endif
+
+/* How many read but not yet released entries there can be,
+ * before the threads stop reading ahead.
+ */
+static const std::size_t MaxPendingEntries = 256*1024;
+
+struct DirTree::Impl
+{
+    bool dotfiles, follow;
+
+#ifdef HAVE_STD_THREAD
+    struct Queue
+    {
+        std::mutex lock{};
+        std::deque<std::shared_ptr<DirNode>> nodes{};
+    };
+    // One queue per thread, and the last one for the caller
+    std::vector<std::unique_ptr<Queue>> queues{};
+    std::vector<std::thread> threads{};
+
+    std::mutex state{};
+    std::condition_variable work{};     // Nodes queued, or room for their entries
+    std::condition_variable finished{};
+    std::size_t queued  = 0; // Nodes in all queues
+    std::size_t pending = 0; // Entries in read but not released nodes
+    bool quit = false;
+#endif
+
+    Impl(bool d, bool f) : dotfiles(d), follow(f) { }
+
+    static bool Claim(DirNode& node)
+    {
+        int expected = 0;
+        return node.State.compare_exchange_strong(expected, 1);
+    }
+
+    void Read(DirNode& node, unsigned queue)
+    {
+        DirReader dir;
+        if(!dir.Open(node.Path))
+        {
+            node.OpenError = errno ? errno : EIO;
+            return;
+        }
+        if(node.Ancestors.empty())
+        {
+            // The top directory. Find out what it is.
+            StatType st;
+            if(StatAt(AT_FDCWD, {}, node.Path.c_str(), &st, true) == 0)
+                node.Ancestors.emplace_back(st.st_dev, st.st_ino);
+        }
+
+        ScanCached(dir, node.Path, dotfiles, follow, node.Names, [&](std::vector<StatRequest>& batch)
+        {
+            if(node.Entries.empty())
+                node.Entries = std::move(batch);
+            else
+                std::move(batch.begin(), batch.end(), std::back_inserter(node.Entries));
+        });
+        if(dir.Close() != 0) node.CloseError = errno;
+
+        for(const StatRequest& r: node.Entries)
+        {
+            if(r.Error || !S_ISDIR(r.Stat.st_mode)) continue;
+            if(r.Name == "." || r.Name == "..") continue;
+
+            std::pair<dev_t,ino_t> id(r.Stat.st_dev, r.Stat.st_ino);
+            if(std::find(node.Ancestors.begin(), node.Ancestors.end(), id) != node.Ancestors.end())
+                continue;
+
+            auto sub = std::make_shared<DirNode>();
+            sub->Path      = r.Path();
+            sub->Stat      = r.Stat;
+            sub->Ancestors = node.Ancestors;
+            sub->Ancestors.push_back(id);
+            node.Subdirs.push_back(std::move(sub));
+        }
+
+        // The subdirectories were kept from the name filters
+        // only for entering them. Do not list them.
+        if(NameFiltersUsed)
+            node.Entries.erase(std::remove_if(node.Entries.begin(), node.Entries.end(),
+                [](const StatRequest& r) { return !NameFilterPasses(r.Name); }),
+                node.Entries.end());
+
+#ifdef HAVE_STD_THREAD
+        if(!threads.empty() && !node.Subdirs.empty())
+        {
+            // Push them in reverse, so that the first one is taken first
+            {std::lock_guard<std::mutex> lk(queues[queue]->lock);
+            for(auto i = node.Subdirs.rbegin(); i != node.Subdirs.rend(); ++i)
+                queues[queue]->nodes.push_back(*i);}
+
+            {std::lock_guard<std::mutex> lk(state);
+            queued += node.Subdirs.size();}
+            work.notify_all();
+        }
+#else
+        (void)queue;
+#endif
+    }
+
+    void Finish(DirNode& node)
+    {
+#ifdef HAVE_STD_THREAD
+        std::lock_guard<std::mutex> lk(state);
+        node.Counted = node.Entries.size();
+        pending += node.Counted;
+        node.State = 2;
+        finished.notify_all();
+#else
+        node.State = 2;
+#endif
+    }
+
+#ifdef HAVE_STD_THREAD
+    std::shared_ptr<DirNode> Take(unsigned me)
+    {
+        std::shared_ptr<DirNode> result;
+        // Own queue: the newest one, for going depth-first
+        {std::lock_guard<std::mutex> lk(queues[me]->lock);
+        if(!queues[me]->nodes.empty())
+        {
+            result = std::move(queues[me]->nodes.back());
+            queues[me]->nodes.pop_back();
+        }}
+        // Others' queues: the oldest one, which is likely the biggest job
+        for(std::size_t n = 1; !result && n < queues.size(); ++n)
+        {
+            Queue& q = *queues[(me + n) % queues.size()];
+            std::lock_guard<std::mutex> lk(q.lock);
+            if(!q.nodes.empty())
+            {
+                result = std::move(q.nodes.front());
+                q.nodes.pop_front();
+            }
+        }
+        if(result)
+        {
+            std::lock_guard<std::mutex> lk(state);
+            --queued;
+        }
+        return result;
+    }
+
+    void Worker(unsigned me)
+    {
+        for(;;)
+        {
+            {std::unique_lock<std::mutex> lk(state);
+            work.wait(lk, [&]{ return quit || (queued > 0 && pending < MaxPendingEntries); });
+            if(quit) return;}
+
+            std::shared_ptr<DirNode> node = Take(me);
+            if(!node || !Claim(*node)) continue;
+            Read(*node, me);
+            Finish(*node);
+        }
+    }
+#endif
+};
+
+DirTree::DirTree(bool dotfiles, bool follow, unsigned num_threads)
+    : impl(std::make_unique<Impl>(dotfiles, follow))
+{
+#ifdef HAVE_STD_THREAD
+    num_threads = std::max({num_threads, std::thread::hardware_concurrency(), 2u});
+    for(unsigned n=0; n<=num_threads; ++n)
+        impl->queues.push_back(std::make_unique<Impl::Queue>());
+    for(unsigned n=0; n<num_threads; ++n)
+        impl->threads.emplace_back(&Impl::Worker, impl.get(), n);
+#else
+    (void)num_threads;
+#endif
+}
+
+DirTree::~DirTree()
+{
+#ifdef HAVE_STD_THREAD
+    {std::lock_guard<std::mutex> lk(impl->state);
+    impl->quit = true;}
+    impl->work.notify_all();
+    for(auto& t: impl->threads) t.join();
+#endif
+}
+
+std::shared_ptr<DirNode> DirTree::Root(const std::string& path)
+{
+    auto node = std::make_shared<DirNode>();
+    node->Path = path;
+    return node;
+}
+
+void DirTree::Get(DirNode& node)
+{
+    if(Impl::Claim(node))
+    {
+#ifdef HAVE_STD_THREAD
+        impl->Read(node, impl->queues.size()-1);
+#else
+        impl->Read(node, 0);
+#endif
+        impl->Finish(node);
+        return;
+    }
+#ifdef HAVE_STD_THREAD
+    std::unique_lock<std::mutex> lk(impl->state);
+    impl->finished.wait(lk, [&]{ return node.State == 2; });
+#endif
+}
+
+void DirTree::Release(DirNode& node)
+{
+#ifdef HAVE_STD_THREAD
+    {std::lock_guard<std::mutex> lk(impl->state);
+    impl->pending -= node.Counted;}
+    impl->work.notify_all();
+#endif
+    node.Counted = 0;
+    node.Entries.clear();
+    node.Entries.shrink_to_fit();
+    node.Names = NameArena();
+    node.Subdirs.clear();
+}
+
+void ReadAhead(std::size_t count,
+               const std::function<void(std::size_t)>& read,
+               const std::function<void(std::size_t)>& use)
+{
+#ifdef HAVE_STD_THREAD
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<char> done(count);
+    std::size_t next = 0, used = 0;
+
+    auto worker = [&]
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        for(;;)
+        {
+            cond.wait(lk, [&]{ return next >= count || next < used + ReadAheadLimit; });
+            if(next >= count) return;
+            std::size_t n = next++;
+            lk.unlock();
+            read(n);
+            lk.lock();
+            done[n] = true;
+            cond.notify_all();
+        }
+    };
+
+    unsigned num_threads = std::max({StatJobs, std::thread::hardware_concurrency(), 8u});
+    std::vector<std::thread> threads;
+    for(unsigned n = 0; n < num_threads && n < count; ++n)
+        threads.emplace_back(worker);
+
+    for(std::size_t n = 0; n < count; ++n)
+    {
+        {std::unique_lock<std::mutex> lk(lock);
+        cond.wait(lk, [&]{ return done[n] != 0; });}
+        use(n);
+        {std::lock_guard<std::mutex> lk(lock);
+        used = n+1;}
+        cond.notify_all();
+    }
+    for(auto& t: threads) t.join();
+#else
+    for(std::size_t n = 0; n < count; ++n)
+    {
+        read(n);
+        use(n);
+    }
+#endif
+}
@@ -0,0 +1,99 @@
+#ifndef dirr3_dirtree_hh
+#define dirr3_dirtree_hh
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <functional>
+
+#include "config.h"
+#include "stat.h"
+#include "dirscan.hh"
+
+/***********************************************
+ *
+ * DirTree
+ *
+ *   Reads a directory tree for recursive listing.
+ *   A pool of threads reads and stats the directories
+ *   ahead of time, while the caller goes through them
+ *   in whatever order it likes.
+ *
+ *   Each thread works depth-first on a queue of its own.
+ *   When its queue runs out, it steals the shallowest
+ *   directory from the queue of another thread.
+ *   To bound memory use, the threads stop reading ahead
+ *   when too many entries are waiting for the caller.
+ *
+ *   There are at least num_threads threads, and at least as many
+ *   as the system has processors. Without thread support,
+ *   everything is read by the caller, when it asks for it.
+ *
+ *     Root(path): Creates the node for the top directory.
+ *     Get(node):  Waits until the node has been read. If no
+ *                 thread has started on it yet, the calling
+ *                 thread reads it itself.
+ *     Release(node): The caller is done with the node's
+ *                 Entries, Names and Subdirs. They are freed.
+ *
+ **********************************************************/
+
+struct DirNode
+{
+    std::string Path{};
+    StatType    Stat{};                          // As found in the parent directory
+    int         OpenError = 0, CloseError = 0;   // errno values
+    std::vector<StatRequest>              Entries{}; // In readdir order
+    NameArena                             Names{};   // Of the Entries
+    std::vector<std::shared_ptr<DirNode>> Subdirs{}; // In readdir order
+
+    // Device and inode numbers of this directory and its parents.
+    // Subdirectories found in this list are not entered, so that
+    // symlinks (with -l0) cannot make the listing go in circles.
+    std::vector<std::pair<dev_t,ino_t>> Ancestors{};
+
+    std::atomic<int> State{0}; // 0=waiting, 1=being read, 2=done
+    std::size_t      Counted = 0;
+};
+
+class DirTree
+{
+public:
+    DirTree(bool dotfiles, bool follow, unsigned num_threads);
+    ~DirTree();
+    DirTree(const DirTree&) = delete;
+    DirTree& operator=(const DirTree&) = delete;
+
+    std::shared_ptr<DirNode> Root(const std::string& path);
+    void Get(DirNode& node);
+    void Release(DirNode& node);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/***********************************************
+ *
+ * ReadAhead(count, read, use)
+ *
+ *   Calls read(n) for each n = 0..count-1 in a pool of threads,
+ *   and use(n) in the calling thread in the order of n, each as
+ *   soon as read(n) is done. The reading is mostly waiting for
+ *   the disk or the network, so there can be more threads than
+ *   processors. The threads do not read further than ReadAheadLimit
+ *   items past the one being used.
+ *
+ *   Without thread support, calls read(n) and use(n) by turns.
+ *
+ **********************************************************/
+
+static const std::size_t ReadAheadLimit = 64;
+
+extern void ReadAhead(std::size_t count,
+                      const std::function<void(std::size_t)>& read,
+                      const std::function<void(std::size_t)>& use);
+
+#endif
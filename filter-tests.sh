@@ -0,0 +1,45 @@
+#!/bin/sh
+# Tests for the name filters (--include, --exclude).
+# Run as ./filter-tests.sh [path to dirr], or with make check.
+
+DIRR="${1:-./dirr}"
+case "$DIRR" in /*) ;; *) DIRR="$PWD/$DIRR" ;; esac
+
+TMP="$(mktemp -d)" || exit 1
+trap 'rm -rf "$TMP"' 0
+HOME="$TMP"; export HOME
+
+mkdir -p "$TMP/t/d1/d2/d3"
+touch "$TMP/t/a.parquet" "$TMP/t/b.txt" \
+      "$TMP/t/d1/c.parquet" "$TMP/t/d1/d2/f.txt" \
+      "$TMP/t/d1/d2/d3/e.parquet"
+
+failures=0
+expect()
+{
+	# expect <description> <expected names> <dirr options...>
+	desc="$1"; want="$2"; shift 2
+	got="$(cd "$TMP" && "$DIRR" -m "$@" 2>&1 | grep -o '[a-z][a-z0-9]*\.[a-z][a-z]*' | sort | tr '\n' ' ')"
+	if [ "$got" != "$want" ]; then
+		echo "FAIL: $desc"
+		echo "  expected: $want"
+		echo "  got:      $got"
+		failures=$((failures+1))
+	fi
+}
+
+expect "--include" \
+       "a.parquet " \
+       --include='*.parquet' t
+expect "--exclude" \
+       "b.txt " \
+       --exclude='*.parquet' t
+expect "-R --include enters the directories it does not list" \
+       "a.parquet c.parquet e.parquet " \
+       -R --include='*.parquet' t
+expect "-R --exclude" \
+       "b.txt f.txt " \
+       -R --exclude='*.parquet' t
+
+[ $failures = 0 ] && echo "All filter tests passed."
+[ $failures = 0 ]
@@ -0,0 +1,150 @@
+#include <cstdlib>
+#include <cerrno>
+
+#include "config.h"
+#include "filters.hh"
+#include "dfa_match.hh"
+
+#if defined(HAVE_GETPWENT_PWD_H) || defined(HAVE_GETPWUID_PWD_H)
+# include <pwd.h>
+#endif
+
+bool NameFiltersUsed = false;
+
+static DFA_Matcher Includes, Excludes;
+static bool HaveIncludes = false;
+
+void AddNameFilter(const std::string& pattern, bool include)
+{
+    (include ? Includes : Excludes).AddMatch(pattern, false, 1);
+    if(include) HaveIncludes = true;
+    NameFiltersUsed = true;
+}
+
+void ResetFilters()
+{
+    Includes = DFA_Matcher();
+    Excludes = DFA_Matcher();
+    HaveIncludes    = false;
+    NameFiltersUsed = false;
+
+    StatFilter      = StatFilters();
+    StatFiltersUsed = false;
+}
+
+void CompileNameFilters()
+{
+    Includes.Compile();
+    Excludes.Compile();
+}
+
+bool TestNameFilters(std::string_view name)
+{
+    if(HaveIncludes && !Includes.Test(name, 0)) return false;
+    return !Excludes.Test(name, 0);
+}
+
+StatFilters StatFilter;
+bool StatFiltersUsed = false;
+
+// Reads a number, and a suffix from the given list of suffixes.
+// Each suffix multiplies the number by the corresponding factor.
+static bool ParseScaled(const std::string& s, const char* suffixes, const double* factors, double& result)
+{
+    const char* p = s.c_str();
+    char* end;
+    errno = 0;
+    result = std::strtod(p, &end);
+    if(end == p || errno || result < 0) return false;
+    if(*end)
+    {
+        for(unsigned n = 0; suffixes[n]; ++n)
+            if(*end == suffixes[n])
+            {
+                result *= factors[n];
+                ++end;
+                break;
+            }
+    }
+    return *end == '\0';
+}
+
+bool ParseSize(const std::string& s, SizeType& result)
+{
+    static const double k = 1024.;
+    static const double factors[] = { k, k, k*k, k*k, k*k*k, k*k*k, k*k*k*k, k*k*k*k };
+    double v;
+    if(!ParseScaled(s, "kKmMgGtT", factors, v)) return false;
+    result = (SizeType)v;
+    StatFiltersUsed = true;
+    return true;
+}
+
+bool ParseAge(const std::string& s, std::time_t& result)
+{
+    static const double factors[] = { 1, 60, 3600, 86400, 7*86400 };
+    double v;
+    if(!ParseScaled(s, "smhdw", factors, v)) return false;
+    result = std::time_t(v);
+    StatFiltersUsed = true;
+    return true;
+}
+
+bool ParseOwner(const std::string& s, long& result)
+{
+    const char* p = s.c_str();
+    char* end;
+    long v = std::strtol(p, &end, 10);
+    if(end == p || *end)
+    {
+#if defined(HAVE_GETPWENT_PWD_H) || defined(HAVE_GETPWUID_PWD_H)
+        const struct passwd* pw = getpwnam(p);
+        if(!pw) return false;
+        v = pw->pw_uid;
+#else
+        return false;
+#endif
+    }
+    result = v;
+    StatFiltersUsed = true;
+    return true;
+}
+
+bool ParseTypes(const std::string& s)
+{
+    if(s.empty() || s.find_first_not_of("fdlpscb") != s.npos) return false;
+    StatFilter.Types += s;
+    StatFiltersUsed = true;
+    return true;
+}
+
+bool TypeFilterPasses(unsigned type)
+{
+    if(StatFilter.Types.empty()) return true;
+    char c = 'f';
+    if(S_ISDIR(type)) c = 'd';
+    #ifdef S_ISLNK
+    else if(S_ISLNK(type)) c = 'l';
+    #endif
+    #ifdef S_ISFIFO
+    else if(S_ISFIFO(type)) c = 'p';
+    #endif
+    #ifdef S_ISSOCK
+    else if(S_ISSOCK(type)) c = 's';
+    #endif
+    else if(S_ISCHR(type)) c = 'c';
+    else if(S_ISBLK(type)) c = 'b';
+    return StatFilter.Types.find(c) != StatFilter.Types.npos;
+}
+
+bool TestStatFilters(const StatType& st, std::time_t date)
+{
+    static const std::time_t now = std::time(nullptr);
+
+    if(StatFilter.Larger >= 0 && !(st.st_size > StatFilter.Larger)) return false;
+    if(StatFilter.Smaller >= 0 && !(st.st_size < StatFilter.Smaller)) return false;
+    if(StatFilter.Newer >= 0 && !(date > now - StatFilter.Newer)) return false;
+    if(StatFilter.Older >= 0 && !(date < now - StatFilter.Older)) return false;
+    if(StatFilter.Owner >= 0 && long(st.st_uid) != StatFilter.Owner) return false;
+    return TypeFilterPasses(st.st_mode);
+}
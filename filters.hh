@@ -0,0 +1,89 @@
+#ifndef dirr3_filters_hh
+#define dirr3_filters_hh
+
+#include <string>
+#include <string_view>
+#include <ctime>
+
+#include "stat.h"
+
+/***********************************************
+ *
+ * Name filters (--include, --exclude)
+ *
+ *   The patterns are compiled into DFA_Matchers, the same engine
+ *   that byext() in DIRR_COLORS uses, and the names are tested
+ *   right as they are read from the directory, before anything
+ *   is done to them. An entry is listed if it matches one of the
+ *   --include patterns (or there are none), and none of the
+ *   --exclude patterns.
+ *
+ *     AddNameFilter(pattern, include): Adds a pattern.
+ *     CompileNameFilters():            To be called after the last
+ *                                      AddNameFilter(), before any tests.
+ *     NameFilterPasses(name):          Tests a name.
+ *     NameFiltersUsed:                 Whether any patterns were added.
+ *
+ **********************************************************/
+
+extern bool NameFiltersUsed;
+
+extern void AddNameFilter(const std::string& pattern, bool include);
+extern void CompileNameFilters();
+extern bool TestNameFilters(std::string_view name);
+
+inline bool NameFilterPasses(std::string_view name)
+{
+    return !NameFiltersUsed || TestNameFilters(name);
+}
+
+/***********************************************
+ *
+ * Stat filters (--larger, --smaller, --newer, --older, --type, --owner)
+ *
+ *   Tested right after the stat, before the file goes anywhere.
+ *   The file type is also tested before the stat, where the
+ *   directory tells the type of the entry. With SubdirsNeeded
+ *   (-R), directories are kept there, so they can be entered.
+ *   They are also kept from the name filters, and DirTree
+ *   removes them from the listing after it has found them.
+ *
+ *     ParseSize(s, result): "10", "10k", "1.5G" etc. (powers of 1024)
+ *     ParseAge(s, result):  "30", "30s", "2h", "3d", "1w" into seconds
+ *     ParseOwner(s, result): A user name or a number
+ *     ParseTypes(s):        Any of "fdlpscb". Returns false if invalid.
+ *
+ *     TypeFilterPasses(type): Tests the S_IFMT bits of st_mode.
+ *     StatFilterPasses(stat, date): Tests everything. date is the
+ *                           time chosen with -d#, as in the listing.
+ *
+ **********************************************************/
+
+struct StatFilters
+{
+    SizeType    Larger = -1, Smaller = -1; // -1 = not used
+    std::time_t Newer  = -1, Older   = -1; // Ages in seconds
+    long        Owner  = -1;
+    std::string Types{};                   // Empty = all
+    bool        SubdirsNeeded = false;
+};
+extern StatFilters StatFilter;
+extern bool StatFiltersUsed;
+
+extern bool ParseSize(const std::string& s, SizeType& result);
+extern bool ParseAge(const std::string& s, std::time_t& result);
+extern bool ParseOwner(const std::string& s, long& result);
+extern bool ParseTypes(const std::string& s);
+
+extern bool TypeFilterPasses(unsigned type);
+extern bool TestStatFilters(const StatType& st, std::time_t date);
+
+inline bool StatFilterPasses(const StatType& st, std::time_t date)
+{
+    return !StatFiltersUsed || TestStatFilters(st, date);
+}
+
+/* ResetFilters(): Forgets all of the above. */
+extern void ResetFilters();
+
+#endif
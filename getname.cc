@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <cstring>
 #include <cstdint>
+#include <vector>
 
 #include "config.h"
 #include "getname.hh"
@@ -16,130 +17,174 @@ static const char HLinkArrow[] = " = ";
 int Links;
 #endif
 
-int GetName(std::string fn /* modified, so operate on a copy */,
-            const StatType &sta, int Space,
-            bool Fill, bool nameonly,
-            const char *hardlinkfn)
+int RenderName(std::string_view fn, const StatType &sta, const char *hardlinkfn,
+               std::string& bytes, std::vector<NamePart>& parts)
 {
+    // Where fn points, once it no longer is the given name
+    std::string fn_storage;
+
     const StatType *Stat = &sta;
+    StatType Stat1{};
 
-    unsigned Len = 0;
-    bool estimating = (Space == 0);
+    int Len = 0;
     bool maysublink = true;
     bool wasinvalid = false;
+    bool inhardlink = false; // The hardlink part is not measured
 
-    std::string fn_print = nameonly ? std::string(NameOnly(fn)) : fn;
-#ifdef S_ISLNK
-Redo:
-#endif
-    // We land here to print a name.
-    // The color has already been prepared where
-    // either this function is called, or Redo is jumped to.
-
-    auto PrintIfRoom = [&](std::string_view what)
+    auto AddText = [&](std::string_view what, std::size_t skip)
     {
-        int i = WidthInColumns(what);
-        Len += i;
-
-        if(i > Space && nameonly) i = Space;
-
-        int j = WidthPrint(i, what, Fill);
-        Space -= j;
+        int width = WidthInColumns(what.substr(skip));
+        parts.push_back({NamePart::text, 0, 0, bytes.size(), std::uint32_t(what.size()),
+                         std::uint32_t(skip), std::uint32_t(width)});
+        bytes += what;
+        if(!inhardlink) Len += width;
     };
-    auto PutSet = [&](char ch)
+    auto AddMark = [&](char ch)
     {
-        if(estimating)
-            ++Len;
-        else if(Space)
-        {
-            ++Len;
-            --Space;
-            GetModeColor(ColorMode::INFO, ch);
-            Gputch(ch);
-        }
+        parts.push_back({NamePart::mark, ch, GetModeColor(ColorMode::INFO, -ch), 0,0,0,0});
+        if(!inhardlink) ++Len;
     };
-
-    PrintIfRoom(fn_print);
-
-    if(wasinvalid)
-    {
-        PutSet('?');
-    }
-    else
+    auto AddColour = [&](NamePart::Type type, int attr)
     {
-        #ifdef S_ISSOCK
-        if(S_ISSOCK(Stat->st_mode)) PutSet('=');
-        #endif
-        #ifdef S_ISFIFO
-        if(S_ISFIFO(Stat->st_mode)) PutSet('|');
-        #endif
-    }
-    #ifdef S_ISLNK
-    if(!wasinvalid && S_ISLNK(Stat->st_mode))
+        parts.push_back({type, 0, attr, 0,0,0,0});
+    };
+
+    // The color of the name itself is prepared where the name is printed.
+    AddText(fn, fn.size() - NameOnly(fn).size());
+    for(;;)
     {
-        if(Links >= 2 && maysublink)
+        if(wasinvalid)
+        {
+            AddMark('?');
+        }
+        else
         {
-            if(Space > 0) GetModeColor(ColorMode::INFO, '@');
-            PrintIfRoom(SLinkArrow);
+            #ifdef S_ISSOCK
+            if(S_ISSOCK(Stat->st_mode)) AddMark('=');
+            #endif
+            #ifdef S_ISFIFO
+            if(S_ISFIFO(Stat->st_mode)) AddMark('|');
+            #endif
+        }
+        #ifdef S_ISLNK
+        if(!wasinvalid && S_ISLNK(Stat->st_mode))
+        {
+            if(Links >= 2 && maysublink)
+            {
+                AddColour(NamePart::room_colour, GetModeColor(ColorMode::INFO, -'@'));
+                AddText(SLinkArrow, 0);
 
-            StatType Stat1;
-            std::string Buf = LinkTarget(fn, true);
+                fn_storage.assign(fn);
+                std::string Buf = LinkTarget(fn_storage, true);
 
-            /* Analyze the link target. */
-            if(StatFunc(Buf.c_str(), &Stat1) < 0)
-            {
-                if(LStatFunc(Buf.c_str(), &Stat1) < 0)
+                /* Analyze the link target. */
+                if(StatFunc(Buf.c_str(), &Stat1) < 0)
                 {
-                    wasinvalid = true;
-                    if(Space > 0) GetModeColor(ColorMode::TYPE, '?');
+                    if(LStatFunc(Buf.c_str(), &Stat1) < 0)
+                    {
+                        wasinvalid = true;
+                        AddColour(NamePart::room_colour, GetModeColor(ColorMode::TYPE, -'?'));
+                    }
+                    else
+                        AddColour(NamePart::room_colour, GetModeColor(ColorMode::TYPE, -'l'));
+                    maysublink = false;
                 }
                 else
                 {
-                    if(Space > 0) GetModeColor(ColorMode::TYPE, 'l');
+                    StatType Stat2;
+                    if(LStatFunc(Buf.c_str(), &Stat2) >= 0 && S_ISLNK(Stat2.st_mode))
+                        AddColour(NamePart::room_colour, GetModeColor(ColorMode::TYPE, -'l'));
+                    else
+                        AddColour(NamePart::room_colour, GetNameAttr(Stat1, Buf));
                 }
-                maysublink = false;
-            }
-            else if(Space > 0)
-            {
-                StatType Stat2;
-                if(LStatFunc(Buf.c_str(), &Stat2) >= 0 && S_ISLNK(Stat2.st_mode))
-                   GetModeColor(ColorMode::TYPE, 'l');
-                else
-                   SetAttr(GetNameAttr(Stat1, Buf));
+
+                fn_storage = LinkTarget(fn_storage, false); // Unfixed link.
+                fn   = fn_storage;
+                Stat = &Stat1;
+                AddText(fn, 0);
+                continue;
             }
+            AddMark('@');
+        }
+        else if(!wasinvalid)
+        #endif
+        {
+            if(S_ISDIR(Stat->st_mode))     AddMark('/');
+            else if(Stat->st_mode & 00111) AddMark('*'); // Executable by someone
+        }
+
+        if(hardlinkfn)
+        {
+            parts.push_back({NamePart::hardlink, 0,0,0,0,0,0});
+            inhardlink = true;
 
-            fn       = LinkTarget(fn, false); // Unfixed link.
-            fn_print = fn;
+            AddColour(NamePart::colour, GetModeColor(ColorMode::INFO, -'&'));
+            AddText(HLinkArrow, 0);
+
+            std::string fn_print = Relativize(fn, hardlinkfn);
+
+            StatFunc(hardlinkfn, &Stat1);
+            AddColour(NamePart::colour, GetNameAttr(Stat1, NameOnly(hardlinkfn)));
+            hardlinkfn = NULL;
             Stat = &Stat1;
-            goto Redo;
-        }
-        PutSet('@');
-    }
-    else if(!wasinvalid)
-    #endif
-    {
-        if(S_ISDIR(Stat->st_mode))     PutSet('/');
-        else if(Stat->st_mode & 00111) PutSet('*'); // Executable by someone
-    }
 
-    if(hardlinkfn && Space)
-    {
-        StatType Stat1;
+            maysublink = false;
+            wasinvalid = false;
 
-        GetModeColor(ColorMode::INFO, '&');
-        PrintIfRoom(HLinkArrow);
+            AddText(fn_print, 0);
+            continue;
+        }
+        break;
+    }
+    return Len;
+}
 
-        fn_print = Relativize(fn, hardlinkfn);
+int PrintName(const std::string& bytes, const NamePart* parts, std::size_t count,
+              int Space, bool Fill, bool nameonly)
+{
+    unsigned Len = 0;
+    bool estimating = (Space == 0);
 
-        StatFunc(hardlinkfn, &Stat1);
-        SetAttr(GetNameAttr(Stat1, NameOnly(hardlinkfn)));
-        hardlinkfn = NULL;
-        Stat = &Stat1;
+    for(std::size_t n = 0; n < count; ++n)
+    {
+        const NamePart& p = parts[n];
+        switch(p.type)
+        {
+            case NamePart::text:
+            {
+                std::string_view what(bytes.data() + p.offset, p.length);
+                int i = p.width;
+                if(nameonly) what.remove_prefix(p.skip);
+                else if(p.skip) i = WidthInColumns(what);
+                Len += i;
 
-        maysublink = false;
-        wasinvalid = false;
+                if(i > Space && nameonly) i = Space;
 
-        goto Redo;
+                int j = WidthPrint(i, what, Fill);
+                Space -= j;
+                break;
+            }
+            case NamePart::mark:
+                if(estimating)
+                    ++Len;
+                else if(Space)
+                {
+                    ++Len;
+                    --Space;
+                    SetAttr(p.attr);
+                    Gputch(p.ch);
+                }
+                break;
+            case NamePart::colour:
+                SetAttr(p.attr);
+                break;
+            case NamePart::room_colour:
+                if(Space > 0) SetAttr(p.attr);
+                break;
+            case NamePart::hardlink:
+                if(!Space) n = count-1;
+                break;
+        }
     }
 
     if(Fill && Space > 0)
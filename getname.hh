@@ -2,6 +2,9 @@
 #define dirr3_getname_hh
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
 
 #include "stat.h"
 
@@ -11,25 +14,49 @@ extern int Links;
 
 /***********************************************
  *
- * GetName(fn, Stat, Space, Fill)
+ * RenderName(fn, Stat, hardlinkfn, bytes, parts)
  *
- *   Prints the filename
+ *   Looks up what is printed of the filename: the marks
+ *   =,|,?,/,*,@ after it, the target of a symlink (with -l2 to -l5)
+ *   and the first name of a hardlink, and their colours.
+ *   The texts are appended to bytes, and the rest to parts.
  *
- *     fn:     Filename
- *     Stat:   stat-bufferi, jonka modesta riippuen
- *             saatetaan tulostaa pern merkkej
- *             =,|,?,/,*,@. Mys ->:t katsotaan.
- *     Space:  Maximum usable printing space.
- *     Fill:   Jos, ylimrinen tila tytetn
- *             spaceilla oikealta puolelta.
+ *   Return value: The width, as the name is measured
+ *                 (only the name part of fn, no hardlink)
+ *
+ * PrintName(bytes, parts, count, Space, Fill, nameonly)
+ *
+ *   Prints a name rendered with RenderName().
+ *
+ *     Space:    Maximum usable printing space.
+ *               The hardlink is printed only if room is left.
+ *     Fill:     If set, the rest of Space is filled with spaces.
+ *     nameonly: Print only the name part of fn, and cut
+ *               the texts at Space.
  *
  *   Return value: True (not necessarily printed) length
  *
  **********************************************************/
 
-int GetName(std::string fn /* modified, so operate on a copy */,
-            const StatType &sta, int Space,
-            bool Fill, bool nameonly,
-            const char *hardlinkfn);
+struct NamePart
+{
+    enum Type : unsigned char
+    {
+        text,        // bytes, from offset. skip = length of the directory part
+        mark,        // ch, in the colour attr
+        colour,      // Sets attr
+        room_colour, // Sets attr, if there is room left
+        hardlink     // What follows is printed only if there is room left
+    } type;
+    char          ch;
+    int           attr;
+    std::size_t   offset;
+    std::uint32_t length, skip, width;
+};
+
+extern int RenderName(std::string_view fn, const StatType &Stat, const char *hardlinkfn,
+                      std::string& bytes, std::vector<NamePart>& parts);
+extern int PrintName(const std::string& bytes, const NamePart* parts, std::size_t count,
+                     int Space, bool Fill, bool nameonly);
 
 #endif
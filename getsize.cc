@@ -29,12 +29,12 @@ static bool LinkFormatStatsOfTarget()
     return Links==3 || Links==5;
 }
 
-string GetSize(const string &s, const StatType &Sta, int Space, int Seps)
+string RenderSize(const string &s, const StatType &Sta, int Seps, ColorDescr& descr)
 {
     const StatType *Stat = &Sta;
 
     std::string result;
-    ColorDescr descr = ColorDescr::DESCR;
+    descr = ColorDescr::DESCR;
 
 #ifdef S_ISLNK
 GotSize:
@@ -112,6 +112,13 @@ P1:
 
         if(descr != ColorDescr(-1)) descr = ColorDescr::SIZE;
     }
+    return result;
+}
+
+string GetSize(const string &s, const StatType &Sta, int Space, int Seps)
+{
+    ColorDescr descr;
+    std::string result = RenderSize(s, Sta, Seps, descr);
 
     if(descr != ColorDescr(-1))
         GetDescrColor(descr, 1);
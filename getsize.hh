@@ -3,8 +3,26 @@
 
 #include <string>
 
+#include "setfun.hh"
+
 extern string BlkStr, ChrStr;
 
+/***********************************************
+ *
+ * RenderSize(fn, Stat, Seps, descr)
+ *
+ *   Returns the size field of the file, without padding,
+ *   and sets descr to the colour to print it in.
+ *   ColorDescr(-1) means the colour of '@' (a symlink).
+ *
+ * GetSize(fn, Stat, Space, Seps)
+ *
+ *   The same, right-aligned to Space columns.
+ *   Also sets the colour.
+ *
+ **********************************************************/
+
+extern string RenderSize(const string &s, const StatType &Sta, int Seps, ColorDescr& descr);
 extern string GetSize(const string &s, const StatType &Sta, int Space, int Seps);
 
 #endif
@@ -13,6 +13,7 @@ static const char VERSIONSTR[] =
 #include <cstring>
 #include <cstdlib>
 #include <cctype>
+#include <cstdint>
 #include <ctime>
 #include <cerrno>
 #include <csignal>
@@ -27,11 +28,23 @@ static const char VERSIONSTR[] =
 #include "getsize.hh"
 #include "totals.hh"
 #include "argh.hh"
+#include "dirscan.hh"
+#include "dirtree.hh"
+#include "dircache.hh"
+#include "filters.hh"
+#include "records.hh"
 
 #include <algorithm>
 #include <vector>
 #include <string>
 #include <list>
+#include <memory>
+#include <deque>
+#include <tuple>
+
+#ifdef HAVE_STD_THREAD
+# include <thread>
+#endif
 
 #ifdef HAVE_SYS_TYPES_H
 # include <sys/types.h>
@@ -39,16 +52,6 @@ static const char VERSIONSTR[] =
 
 #include <unistd.h>
 
-#ifdef HAVE_READDIR_DIR_H
-# include <dir.h>
-#endif
-#ifdef HAVE_READDIR_DIRENT_H
-# include <dirent.h>
-#endif
-#ifdef HAVE_READDIR_DIRECT_H
-# include <direct.h>
-#endif
-
 #include "stat.h"
 
 static int RowLen;
@@ -64,13 +67,15 @@ struct Estimation
 static std::vector<Estimation> Longest; // Per-column limits
 
 static bool ShowDotFiles = ALWAYS_SHOW_DOTFILES;
-static bool Contents, PreScan, MultiColumn, VerticalColumns;
+static bool Contents, PreScan, MultiColumn, VerticalColumns, Recursive;
 static unsigned CurrentColumn;
+static std::size_t TopCount, DumpedCount; // --top=N, and how many were printed with -e
 static int DateTime, MyUid=-1, MyGid=-1;
 
 static std::string Sorting; /* n,d,s,u,g */
 static std::string DateForm;
 static std::string FieldOrder;
+static std::string InputFile; // Read the listing from this, with -I
 
 struct FieldInfo
 {
@@ -103,6 +108,9 @@ static void SetDefaultOptions()
     #endif
     Colors  = isatty(1); // Clear with -c, set with -c1
     Contents= true; // Clear with -D
+    Recursive = false; // Set with -R
+    TopCount = 0;   // Modify with -t
+    ResetFilters(); // Add with -i, -x, -L, -S, -n, -N, -T, -u
     DateTime= 2;    // Modify with -d#
     Totals  = true; // Modify with -m
     Pagebreaks = false; // Set with -p
@@ -116,12 +124,18 @@ static void SetDefaultOptions()
                     // Modify with -F
 
                     // Modify with -f
+    Records = RecordFormat::none;
+    InputFile.clear(); // Set with -I
     #ifdef DJGPP
     FieldOrder = ".f_.s_.d";
     #else
     FieldOrder = ".f_.s_.a4_.d_.o_.g";
     #endif
 
+    StatJobs = 1;   // Modify with -j
+    DirCache = 0;   // Modify with -k#
+    UseStatRing = false; // Modify with -U#
+
     BlkStr = "<B%u,%u>"; // Modify with -db
     ChrStr = "<C%u,%u>"; // Modify with -dc
 }
@@ -217,80 +231,366 @@ struct FieldsToPrint: public std::vector<FieldInfo> // ParsedFieldOrder
     }
 } FieldsToPrint;
 
+/* The text fields of the files (sizes, owners, groups and link
+ * counts) are rendered once, when the files are measured, and
+ * printed from here. Each file has a row of cells, one for each
+ * of those fields in use. The bytes of all cells are in one string.
+ * Colours can only be looked up while printing, so a cell holds
+ * the colour description rather than the attribute.
+ * The name of each file is rendered with RenderName() into the
+ * same string, so that symlinks and hardlinks are looked up once.
+ */
+class CellCache
+{
+    struct Cell
+    {
+        std::size_t   Offset;
+        std::uint16_t Length;
+        signed char   Descr; // ColorDescr, or -1 for the colour of '@'
+        signed char   Index;
+    };
+    std::string       Bytes{};
+    std::vector<Cell> Cells{};
+    std::vector<NamePart> NameParts{};
+    std::vector<std::pair<std::size_t,std::size_t>> Names{}; // Range of NameParts, per row
+    int      Slot[FieldInfo::num_different_fields]{};
+    unsigned PerRow = 0;
+    char     Seps = 0; // Thousands separator of the size_sep cells
 
-#include <unordered_map>
+public:
+    // Starts over, with the fields in FieldsToPrint.
+    void Clear()
+    {
+        PerRow = 0;
+        for(unsigned t=0; t<FieldInfo::num_different_fields; ++t)
+            switch(t)
+            {
+                case FieldInfo::size: case FieldInfo::size_compact: case FieldInfo::size_sep:
+                case FieldInfo::user_name: case FieldInfo::user_id:
+                case FieldInfo::group_name: case FieldInfo::group_id:
+                case FieldInfo::nrlinks:
+                    Slot[t] = FieldsToPrint.used[t] ? int(PerRow++) : -1;
+                    break;
+                default:
+                    Slot[t] = -1;
+            }
+        Seps = '\'';
+        for(const auto& f: FieldsToPrint)
+            if(f.type == FieldInfo::size_sep) { Seps = char(f.info & 0x7F); break; }
+        Bytes.clear();
+        Cells.clear();
+        NameParts.clear();
+        Names.clear();
+    }
+    bool Used(unsigned type) const { return Slot[type] >= 0; }
+    char SizeSeps() const { return Seps; }
+
+    void Put(std::size_t row, unsigned type, std::string_view text, ColorDescr descr, int index)
+    {
+        if(Cells.size() < (row+1) * PerRow) Cells.resize((row+1) * PerRow);
+        Cells[row * PerRow + Slot[type]] = Cell{Bytes.size(), std::uint16_t(text.size()),
+                                                (signed char)descr, (signed char)index};
+        Bytes += text;
+    }
+    std::string_view Text(std::size_t row, unsigned type) const
+    {
+        const Cell& c = Cells[row * PerRow + Slot[type]];
+        return std::string_view(Bytes).substr(c.Offset, c.Length);
+    }
+    // Renders the name of the file. Returns its width.
+    int PutName(std::size_t row, std::string_view name, const StatType& Stat, const char* hardlinkfn)
+    {
+        if(Names.size() < row+1) Names.resize(row+1);
+        std::size_t begin = NameParts.size();
+        int width = RenderName(name, Stat, hardlinkfn, Bytes, NameParts);
+        Names[row] = {begin, NameParts.size()};
+        return width;
+    }
+    int PrintName(std::size_t row, int Space, bool Fill, bool nameonly) const
+    {
+        auto [begin, end] = Names[row];
+        return ::PrintName(Bytes, NameParts.data() + begin, end - begin, Space, Fill, nameonly);
+    }
+    void SetColour(std::size_t row, unsigned type) const
+    {
+        const Cell& c = Cells[row * PerRow + Slot[type]];
+        if(c.Descr < 0)
+            GetModeColor(ColorMode::INFO, '@');
+        else
+            GetDescrColor(ColorDescr(c.Descr), c.Index);
+    }
+};
+static CellCache RenderedCells;
+
+
+/* Remembers the first name seen of each file that has more than one
+ * hard link, so that its other names can be shown as links to it.
+ * Files with a single link are not stored, unless symlinks are
+ * followed, because then a file can be listed under many names.
+ *
+ * The table uses open addressing with linear probing, and the names
+ * are stored nul-terminated one after another in a single string.
+ *
+ * When every name is listed only once (one commandline argument,
+ * symlinks not followed), a file is forgotten once as many of its
+ * names have been printed as it has links. Otherwise the same name
+ * may come again, and must still be shown as a link to the first
+ * one, so the files are remembered for the whole run, as before.
+ * When following symlinks, that means every file listed.
+ */
 static class Inodemap
 {
-    std::unordered_map<dev_t, std::unordered_map<ino_t, std::string>> items;
-    bool enabled;
+    struct Slot
+    {
+        dev_t       dev;
+        ino_t       ino;
+        std::size_t name; // Offset in names
+        nlink_t     left; // Links not yet printed. 0 = free slot.
+    };                    // Without forget, 1 for those in use.
+    std::vector<Slot> slots;
+    std::size_t used;
+    std::string names;
+    std::size_t garbage;  // Bytes of names of forgotten files
+    bool enabled, follow, forget;
+
+    bool stored(const StatType& Stat) const
+    {
+        return Stat.st_nlink >= 2 || follow;
+    }
+    std::size_t home(dev_t dev, ino_t ino) const
+    {
+        std::uint64_t h = ((std::uint64_t)ino ^ ((std::uint64_t)dev << 40 | (std::uint64_t)dev >> 24))
+                        * 0x9E3779B97F4A7C15ull;
+        return (h >> 32) & (slots.size()-1);
+    }
+    // Returns the slot of the file, or the free slot where it would go.
+    std::size_t find(dev_t dev, ino_t ino) const
+    {
+        std::size_t i = home(dev, ino);
+        while(slots[i].left && (slots[i].dev != dev || slots[i].ino != ino))
+            i = (i+1) & (slots.size()-1);
+        return i;
+    }
+    void grow()
+    {
+        std::vector<Slot> old(std::max<std::size_t>(64, slots.size()*2));
+        old.swap(slots);
+        for(const Slot& s: old)
+            if(s.left)
+                slots[find(s.dev, s.ino)] = s;
+    }
+    void erase(std::size_t i)
+    {
+        // Move back the entries that would not be found past the hole
+        for(std::size_t j = i; ; )
+        {
+            j = (j+1) & (slots.size()-1);
+            if(!slots[j].left) break;
+            std::size_t k = home(slots[j].dev, slots[j].ino);
+            if(i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+            slots[i] = slots[j];
+            i = j;
+        }
+        slots[i].left = 0;
+    }
+    void compact()
+    {
+        std::string kept;
+        kept.reserve(names.size() - garbage);
+        for(Slot& s: slots)
+            if(s.left)
+            {
+                const char* n = names.data() + s.name;
+                s.name = kept.size();
+                kept.append(n, std::strlen(n)+1);
+            }
+        names.swap(kept);
+        garbage = 0;
+    }
 public:
-    Inodemap() : items(), enabled(true) { }
+    Inodemap() : slots(), used(0), names(), garbage(0), enabled(true), follow(false), forget(false) { }
     void disable()
     {
         enabled = false;
-        items.clear();
+        slots.clear();
+        names.clear();
+        used = garbage = 0;
     }
     void enable()
     {
         enabled = true;
     }
-    void insert(dev_t dev, ino_t ino, const std::string &name)
+    bool is_enabled() const
     {
-        if(enabled)
-        {
-            auto i = items.find(dev);
-            if(i == items.end())
-                items.emplace(dev, std::unordered_map<ino_t,string>{{ino,name}} );
-            else
-            {
-                auto j = i->second.find(ino);
-                if(j == i->second.end())
-                    i->second.emplace(ino, name);
-            }
-        }
+        return enabled;
+    }
+    // Whether the files are stat'ed through symlinks,
+    // and whether each name is listed only once.
+    void follow_links(bool f, bool once)
+    {
+        follow = f;
+        forget = once && !follow;
+    }
+    void insert(const StatType& Stat, const std::string &name)
+    {
+        if(!enabled || !stored(Stat) || S_ISDIR(Stat.st_mode)) return;
+        if((used+1)*2 > slots.size()) grow();
+        Slot& s = slots[find(Stat.st_dev, Stat.st_ino)];
+        if(s.left) return;
+        s = Slot{Stat.st_dev, Stat.st_ino, names.size(), forget ? Stat.st_nlink : nlink_t(1)};
+        names.append(name.c_str(), name.size()+1);
+        ++used;
+    }
+    // The pointer is valid until the next insert() or printed().
+    const char *get(const StatType& Stat) const
+    {
+        if(!stored(Stat) || slots.empty()) return nullptr;
+        const Slot& s = slots[find(Stat.st_dev, Stat.st_ino)];
+        return s.left ? names.data() + s.name : nullptr;
     }
-    const char *get(dev_t dev, ino_t ino) const
+    // Tells that one of the names of the file has been printed.
+    void printed(const StatType& Stat)
     {
-        auto i = items.find(dev);
-        if(i != items.end())
+        if(!forget || Stat.st_nlink < 2 || slots.empty()) return;
+        std::size_t i = find(Stat.st_dev, Stat.st_ino);
+        if(!slots[i].left || --slots[i].left) return;
+        garbage += std::strlen(names.data() + slots[i].name) + 1;
+        erase(i);
+        --used;
+        if(garbage > 65536 && garbage > names.size()/2) compact();
+    }
+} Inodemap;
+
+// Find out which stat fields the chosen format, sorting and totals
+// actually look at, so that the rest need not be asked for.
+static unsigned StatFieldsNeeded()
+{
+    unsigned DateField = DateTime == 1 ? StatFieldAtime
+                       : DateTime == 3 ? StatFieldCtime
+                       :                 StatFieldMtime;
+    unsigned result = 0; // The file type is always there
+
+    if(Totals) result |= StatFieldSize;
+    if(StatFilter.Larger >= 0 || StatFilter.Smaller >= 0) result |= StatFieldSize;
+    if(StatFilter.Newer >= 0 || StatFilter.Older >= 0) result |= DateField;
+    if(StatFilter.Owner >= 0) result |= StatFieldUid;
+    if(Recursive) result |= StatFieldIno; // For detecting loops
+
+    if(Records != RecordFormat::none)
+    {
+        if(Records != RecordFormat::nul)
+            result |= StatFieldMode | StatFieldNlink | StatFieldUid | StatFieldGid
+                    | StatFieldSize | StatFieldIno | DateField;
+    }
+    else for(const auto& f: FieldsToPrint)
+        switch(f.type)
+        {
+            case FieldInfo::user_id:
+            case FieldInfo::user_name:    result |= StatFieldUid; break;
+            case FieldInfo::group_id:
+            case FieldInfo::group_name:   result |= StatFieldGid; break;
+            case FieldInfo::nrlinks:      result |= StatFieldNlink; break;
+            case FieldInfo::size:
+            case FieldInfo::size_compact:
+            case FieldInfo::size_sep:     result |= StatFieldSize; break;
+            case FieldInfo::datetime:     result |= DateField; break;
+            case FieldInfo::attribute:    result |= StatFieldMode; break;
+            case FieldInfo::name: // Colour and the '*' suffix
+                result |= StatFieldExec;
+                if(Inodemap.is_enabled()) result |= StatFieldIno | StatFieldNlink;
+                break;
+            default: break;
+        }
+
+    for(char c: Sorting)
+        switch(c)
         {
-            auto j = i->second.find(ino);
-            if(j != i->second.end())
-                return j->second.c_str();
+            case 's': case 'S': result |= StatFieldSize; break;
+            case 'd': case 'D': result |= DateField; break;
+            case 'u': case 'U': result |= StatFieldUid; break;
+            case 'g': case 'G': result |= StatFieldGid; break;
+            case 'h': case 'H': result |= StatFieldNlink; break;
+            case 'c': case 'C': result |= StatFieldExec; break;
+            case 'r': case 'R': case 'p': case 'P':
+            case 'e': case 'E': case 'n': case 'N': case 'm': case 'M':
+                break;
+            default: return StatFieldAll; // Error is reported when sorting
         }
-        return nullptr;
+    return result;
+}
+
+// FileDate: The time chosen with -d#.
+static time_t FileDate(const StatType &Stat)
+{
+    switch(DateTime)
+    {
+        case 1: return Stat.st_atime;
+        case 3: return Stat.st_ctime;
     }
-} Inodemap;
+    return Stat.st_mtime;
+}
+
+// CountFile: Adds the file into the totals.
+static void CountFile(const StatType &Stat)
+{
+    SizeType size = Stat.st_size;
+    int category  = SumFile;
+
+    if(S_ISDIR(Stat.st_mode)) { category = SumDir; }
+    #ifdef S_ISFIFO
+    else if(S_ISFIFO(Stat.st_mode)) { category = SumFifo; }
+    #endif
+    #ifdef S_ISSOCK
+    else if(S_ISSOCK(Stat.st_mode)) { category = SumSock; }
+    #endif
+    else if(S_ISCHR(Stat.st_mode)) { category = SumChrDev; size = 0; }
+    else if(S_ISBLK(Stat.st_mode)) { category = SumBlkDev; size = 0; }
+    #ifdef S_ISLNK
+    else if(S_ISLNK(Stat.st_mode)) { category = SumLink; }
+    #endif
+    SumCnt[category]   += 1;
+    SumSizes[category] += size;
+}
+
+// GwriteRight: Prints s right-aligned in space columns.
+static std::size_t GwriteRight(std::string_view s, std::size_t space)
+{
+    std::size_t n = 0;
+    for(; s.size() + n < space; ++n) Gputch(' ');
+    return n + Gwrite(s);
+}
+
+/* Set by the handler of SIGINT and SIGTERM. The listing stops at the
+ * next file, where the output is not in the middle of being changed.
+ */
+static volatile std::sig_atomic_t Interrupted = 0;
+
+static void StopIfInterrupted()
+{
+    if(!Interrupted) return;
+    Gprintf("^C\n");
+
+    RowLen=1;
+    PrintSums();
+
+    // The reader threads may still be running, so do not run the destructors
+    Gflush();
+    _exit(0);
+}
 
-static void TellMe(const StatType &Stat, std::string&& Name
+// TellMe: Prints the file. Its text fields are in row Row of Cells.
+static void TellMe(const StatType &Stat, const std::string& Name,
+                   const CellCache& Cells, std::size_t Row
 #ifdef DJGPP
     , unsigned int dosattr
 #endif
     )
 {
-    std::string OwNum,GrNum,OwNam,GrNam;
+    StopIfInterrupted();
+
     std::size_t ItemLen = 0;
 
-    if(true) // scope for updating totals
-    {
-        SizeType size = Stat.st_size;
-        int category  = SumFile;
-
-        if(S_ISDIR(Stat.st_mode)) { category = SumDir; }
-        #ifdef S_ISFIFO
-        else if(S_ISFIFO(Stat.st_mode)) { category = SumFifo; }
-        #endif
-        #ifdef S_ISSOCK
-        else if(S_ISSOCK(Stat.st_mode)) { category = SumSock; }
-        #endif
-        else if(S_ISCHR(Stat.st_mode)) { category = SumChrDev; size = 0; }
-        else if(S_ISBLK(Stat.st_mode)) { category = SumBlkDev; size = 0; }
-        #ifdef S_ISLNK
-        else if(S_ISLNK(Stat.st_mode)) { category = SumLink; }
-        #endif
-        SumCnt[category]   += 1;
-        SumSizes[category] += size;
-    }
+    CountFile(Stat);
 
     auto& Limits = CurrentColumn < Longest.size() ? Longest[CurrentColumn] : Longest.back();
 
@@ -320,90 +620,62 @@ static void TellMe(const StatType &Stat, std::string&& Name
                 break;
             }
             case FieldInfo::user_name:
-            {
-                if(MyUid<0)MyUid=getuid();
-                GetDescrColor(ColorDescr::OWNER, ((int)Stat.st_uid==MyUid)?1:2);
-                if(OwNam.empty())
-                {
-                    OwNam = Getpwuid((int)Stat.st_uid);
-                    if(OwNam.empty()) { if(OwNum.empty()) OwNum = std::to_string(Stat.st_uid); OwNam = OwNum; }
-                }
-                ItemLen += (f.info ? Gwrite(OwNam, Limits.UIDname) : Gwrite(OwNam));
-                break;
-            }
             case FieldInfo::user_id:
-            {
-                if(MyUid<0) MyUid=getuid();
-                GetDescrColor(ColorDescr::OWNER, ((int)Stat.st_uid==MyUid)?1:2);
-                if(OwNum.empty()) OwNum = std::to_string(Stat.st_uid);
-                ItemLen += (f.info ? Gwrite(OwNum, Limits.UIDnumber) : Gwrite(OwNum));
-                break;
-            }
             case FieldInfo::group_name:
-            {
-                if(MyGid<0) MyGid=getgid();
-                GetDescrColor(ColorDescr::GROUP, ((int)Stat.st_gid==MyGid)?1:2);
-                if(GrNam.empty())
-                {
-                    GrNam = Getgrgid((int)Stat.st_gid);
-                    if(GrNam.empty()) { if(GrNum.empty()) GrNum = std::to_string(Stat.st_gid); GrNam = GrNum; }
-                }
-                ItemLen += (f.info ? Gwrite(GrNam, Limits.GIDname) : Gwrite(GrNam));
-                break;
-            }
             case FieldInfo::group_id:
-            {
-                if(MyGid<0) MyGid=getgid();
-                GetDescrColor(ColorDescr::GROUP, ((int)Stat.st_gid==MyGid)?1:2);
-                if(GrNum.empty()) GrNum = std::to_string(Stat.st_gid);
-                ItemLen += (f.info ? Gwrite(GrNum, Limits.GIDnumber) : Gwrite(GrNum));
-                break;
-            }
             case FieldInfo::nrlinks:
             {
-                GetDescrColor(ColorDescr::NRLINK, 1);
-                ItemLen += (f.info ? Gwrite(std::to_string(Stat.st_nlink), Limits.Links) : Gwrite(std::to_string(Stat.st_nlink)));
+                std::size_t pad = f.type == FieldInfo::user_name  ? Limits.UIDname
+                                : f.type == FieldInfo::user_id    ? Limits.UIDnumber
+                                : f.type == FieldInfo::group_name ? Limits.GIDname
+                                : f.type == FieldInfo::group_id   ? Limits.GIDnumber
+                                :                                   Limits.Links;
+                Cells.SetColour(Row, f.type);
+                std::string_view text = Cells.Text(Row, f.type);
+                ItemLen += (f.info ? Gwrite(text, pad) : Gwrite(text));
                 break;
             }
             case FieldInfo::name:
             {
                 SetAttr( GetNameAttr(Stat, NameOnly(Name)) );
 
-                const char *hardlinkfn = Inodemap.get(Stat.st_dev, Stat.st_ino);
-                if(hardlinkfn && Name == hardlinkfn) hardlinkfn = nullptr;
                 // Undocumented feature: If fitting is disabled, long pathful filenames are printed
                 bool nameonly = f.info;
                 if(!nameonly && Name.rfind('/')==1 && Name.substr(0,2)=="./") nameonly = true;
-                auto i = GetName(Name, Stat, Limits.Name, MultiColumn || f.info, nameonly, hardlinkfn);
+                auto i = Cells.PrintName(Row, Limits.Name, MultiColumn || f.info, nameonly);
+                Inodemap.printed(Stat);
                 ItemLen += std::max(std::size_t(i), Limits.Name);
                 break;
             }
             case FieldInfo::size:
             {
-                ItemLen += Gwrite(GetSize(Name, Stat, f.info ? Limits.Size : 0, 0));
+                Cells.SetColour(Row, f.type);
+                ItemLen += GwriteRight(Cells.Text(Row, f.type), f.info ? Limits.Size : 0);
                 break;
             }
             case FieldInfo::size_compact:
             {
-                ItemLen += Gwrite(GetSize(Name, Stat, f.info ? Limits.SizeCompact : 0, -1));
+                Cells.SetColour(Row, f.type);
+                ItemLen += GwriteRight(Cells.Text(Row, f.type), f.info ? Limits.SizeCompact : 0);
                 break;
             }
             case FieldInfo::size_sep:
             {
-                ItemLen += Gwrite(GetSize(Name, Stat, (f.info & 0x80) ? Limits.SizeWithSeps : 0, char(f.info & 0x7F)));
+                std::size_t space = (f.info & 0x80) ? Limits.SizeWithSeps : 0;
+                if(char(f.info & 0x7F) != Cells.SizeSeps())
+                    ItemLen += Gwrite(GetSize(Name, Stat, space, char(f.info & 0x7F)));
+                else
+                {
+                    Cells.SetColour(Row, f.type);
+                    ItemLen += GwriteRight(Cells.Text(Row, f.type), space);
+                }
                 break;
             }
             case FieldInfo::datetime:
             {
                 std::string str;
 
-                time_t t = Stat.st_mtime;
-                switch(DateTime)
-                {
-                    case 1: t = Stat.st_atime; break;
-                    //case 2: t = Stat.st_mtime; break;
-                    case 3: t = Stat.st_ctime; break;
-                }
+                time_t t = FileDate(Stat);
 
                 if(DateForm == "%u")
                 {
@@ -471,114 +743,331 @@ static void TellMe(const StatType &Stat, std::string&& Name
     }
 }
 
+/* A collected file. Of the stat information, only the fields that
+ * the listing can show or sort by are kept: a StatType is several
+ * times bigger, and there may be millions of these.
+ */
 class StatItem
 {
 public:
-    StatType Stat;
+    mode_t   Mode;
+    uint32_t Nlink;
+    uid_t    Uid;
+    gid_t    Gid;
+    SizeType Size;
+    time_t   Date; // The one chosen with -d#
+    dev_t    Dev, Rdev;
+    ino_t    Ino;
     #ifdef DJGPP
     unsigned dosattr;
     #endif
-    std::string Name;
+    const std::string* Dir; // Up to and including the last slash
+    std::string_view   Name;
 public:
     StatItem(const StatType &t,
     #ifdef DJGPP
              unsigned da,
     #endif
-             std::string&& n) : Stat(t),
+             NameArena& Names, std::string_view DirName, std::string_view FileName)
+                              : Mode(t.st_mode), Nlink(t.st_nlink),
+                                Uid(t.st_uid), Gid(t.st_gid),
+                                Size(t.st_size), Date(FileDate(t)),
+                                Dev(t.st_dev), Rdev(t.st_rdev), Ino(t.st_ino),
     #ifdef DJGPP
                                 dosattr(da),
     #endif
-                                Name(std::move(n)) { }
+                                Dir(), Name()
+    {
+        std::tie(Dir, Name) = Names.Add(DirName, FileName);
+    }
 
     StatItem(StatItem&&) = default;
     StatItem(const StatItem&) = default;
     StatItem& operator=(StatItem&&) = default;
     StatItem& operator=(const StatItem&) = default;
 
+    // Copies the name into another arena.
+    void MoveTo(NameArena& Names)
+    {
+        std::tie(Dir, Name) = Names.Add(*Dir, Name);
+    }
+
+    void GetPath(std::string& result) const
+    {
+        result.reserve(Dir->size() + Name.size());
+        result.assign(*Dir);
+        result += Name;
+    }
+
+    /* Returns the stat information for printing. The fields
+     * that were not kept are zero. All three dates are Date.
+     */
+    StatType Expand() const
+    {
+        StatType Stat;
+        std::memset(&Stat, 0, sizeof(Stat));
+        Stat.st_mode  = Mode;
+        Stat.st_nlink = Nlink;
+        Stat.st_uid   = Uid;
+        Stat.st_gid   = Gid;
+        Stat.st_size  = Size;
+        Stat.st_atime = Stat.st_mtime = Stat.st_ctime = Date;
+        Stat.st_dev   = Dev;
+        Stat.st_rdev  = Rdev;
+        Stat.st_ino   = Ino;
+        return Stat;
+    }
+
     /* Returns the class code for grouping sort */
     int Class(int LinksAreFiles) const
     {
-        if(S_ISDIR(Stat.st_mode)) return 0;
+        if(S_ISDIR(Mode)) return 0;
         #ifdef S_ISLNK
-        if(S_ISLNK(Stat.st_mode)) return 2-LinksAreFiles;
+        if(S_ISLNK(Mode)) return 2-LinksAreFiles;
         #else
         LinksAreFiles = LinksAreFiles; /* Not used */
         #endif
-        if(S_ISCHR(Stat.st_mode)) return 3;
-        if(S_ISBLK(Stat.st_mode)) return 4;
+        if(S_ISCHR(Mode)) return 3;
+        if(S_ISBLK(Mode)) return 4;
         #ifdef S_ISFIFO
-        if(S_ISFIFO(Stat.st_mode)) return 5;
+        if(S_ISFIFO(Mode)) return 5;
         #endif
         #ifdef S_ISSOCK
-        if(S_ISSOCK(Stat.st_mode)) return 6;
+        if(S_ISSOCK(Mode)) return 6;
         #endif
         return 1;
     }
+};
+
+/* The -o string is turned into a list of keys once.
+ * Each file gets a sort key, which is the concatenation of its keys,
+ * so encoded that memcmp() on two sort keys gives the right order.
+ */
+struct SortKeyPart
+{
+    char Field;    // Lowercase letter from -o
+    bool Reverse;  // Was uppercase
+};
+static std::vector<SortKeyPart> SortPlan;
+static bool SortPlanReady = false;
+
+// CompileSortPlan: Returns false if there is nothing to sort by.
+static bool CompileSortPlan()
+{
+    if(SortPlanReady) return !SortPlan.empty();
+    SortPlanReady = true;
+
+    for(char c: Sorting)
+    {
+        char field = std::tolower(c);
+        // Without colours, sorting by them is not done
+        if(field == 'c' && !Colors) continue;
+        if(!std::strchr("cenmsdughrp", field))
+        {
+            const char *t = Sorting.c_str();
+            SetAttr(GetDescrColor(ColorDescr::TEXT, 1));
+            Gprintf("\nError: `-o");
+            while(*t != c)Gputch(*t++);
+            GetModeColor(ColorMode::INFO, '?');
+            Gputch(*t++);
+            SetAttr(GetDescrColor(ColorDescr::TEXT, 1));
+            Gprintf("%s'\n\n", t);
+            Sorting = "";
+            SortPlan.clear();
+            return false;
+        }
+        SortPlan.push_back({field, c != field});
+    }
+    return !SortPlan.empty();
+}
 
-    bool operator< (const StatItem &other) const
+// Appends a number so that memcmp() orders it like a signed number.
+static void PutKeyNumber(std::string& Key, long long Value, unsigned Bytes)
+{
+    unsigned long long v = (unsigned long long)Value ^ (1ull << (Bytes*8-1));
+    while(Bytes-- > 0) Key += char(v >> (Bytes*8));
+}
+
+static void MakeSortKey(std::string& Key, const StatItem& Item)
+{
+    for(const auto& part: SortPlan)
     {
-        const class StatItem &me = *this;
-        for(char c: Sorting)
+        std::size_t begin = Key.size();
+        switch(part.Field)
         {
-            SizeType Result=0;
-            switch(c)
+            case 'c': PutKeyNumber(Key, GetNameAttr(Item.Expand(), Item.Name), 4); break;
+            case 'e': PutKeyNumber(Key, (long long)(Item.Dir->size() + Item.Name.size()), 8); break;
+            case 'n': Key += *Item.Dir; Key += Item.Name; Key += '\0'; break; // Names do not contain nul bytes
+            case 'm': for(char c: *Item.Dir)  Key += char(std::tolower(c));
+                      for(char c: Item.Name) Key += char(std::tolower(c));
+                      Key += '\0'; break;
+            case 's': PutKeyNumber(Key, Item.Size, 8); break;
+            case 'd': PutKeyNumber(Key, Item.Date, 8); break;
+            case 'u': PutKeyNumber(Key, (int)Item.Uid, 4); break;
+            case 'g': PutKeyNumber(Key, (int)Item.Gid, 4); break;
+            case 'h': PutKeyNumber(Key, (int)Item.Nlink, 4); break;
+            case 'r': Key += char(Item.Class(0)); break;
+            case 'p': Key += char(Item.Class(1)); break;
+        }
+        if(part.Reverse)
+            for(std::size_t a = begin; a < Key.size(); ++a)
+                Key[a] = char(~Key[a]);
+    }
+}
+
+/* Each key is stored in a big buffer. The first 8 bytes of
+ * the key are also kept as a number, so that most comparisons
+ * are decided without looking into the buffer. The index breaks
+ * ties, so no two records are equal, and any correct sorting
+ * method gives the same order.
+ */
+struct SortRecord
+{
+    std::uint64_t Prefix;
+    const char*   Key;
+    std::size_t   Length, Index;
+
+    bool operator< (const SortRecord& b) const
+    {
+        if(Prefix != b.Prefix) return Prefix < b.Prefix;
+        int c = std::string_view(Key, Length).compare(std::string_view(b.Key, b.Length));
+        if(c) return c < 0;
+        return Index < b.Index;
+    }
+};
+
+// Makes the records for f[begin..end), with the keys stored in Keys.
+static void MakeSortRecords(const std::vector<StatItem>& f, std::size_t begin, std::size_t end,
+                            std::string& Keys, SortRecord* Records)
+{
+    // Keys may move while it grows, so the pointers are set afterwards.
+    for(std::size_t a = begin; a < end; ++a)
+    {
+        MakeSortKey(Keys, f[a]);
+        Records[a-begin].Length = Keys.size(); // Where the key ends
+    }
+    for(std::size_t a = begin, pos = 0; a < end; ++a)
+    {
+        SortRecord& r = Records[a-begin];
+        r.Key    = Keys.data() + pos;
+        r.Length = r.Length - pos;
+        r.Index  = a;
+        r.Prefix = 0;
+        for(std::size_t b = 0; b < 8; ++b)
+            r.Prefix = (r.Prefix << 8) | (b < r.Length ? (unsigned char)r.Key[b] : 0u);
+        pos += r.Length;
+    }
+}
+
+#ifdef HAVE_STD_THREAD
+/* Directories with at least this many files are sorted in many threads. */
+static const std::size_t ParallelSortThreshold = 100000;
+
+/* Each thread makes the keys for its own part of the files and sorts
+ * that part. Then pairs of sorted parts are merged, in threads, until
+ * there is only one part left.
+ */
+static void SortRecordsParallel(const std::vector<StatItem>& f, std::vector<SortRecord>& Records,
+                                std::vector<std::string>& Keys, unsigned num_threads)
+{
+    std::size_t count = f.size();
+    std::vector<std::size_t> bounds;
+    for(unsigned n = 0; n <= num_threads; ++n)
+        bounds.push_back(count * n / num_threads);
+
+    // Sorting by colour looks up the settings, which must
+    // not be loaded by many threads at the same time.
+    for(const auto& part: SortPlan)
+        if(part.Field == 'c')
+            LoadColors();
+
+    std::vector<std::thread> threads;
+    Keys.resize(num_threads);
+    for(unsigned n = 0; n < num_threads; ++n)
+        threads.emplace_back([&, n]
+        {
+            SortRecord* part = &Records[bounds[n]];
+            MakeSortRecords(f, bounds[n], bounds[n+1], Keys[n], part);
+            std::sort(part, part + (bounds[n+1] - bounds[n]));
+        });
+    for(auto& t: threads) t.join();
+
+    std::vector<SortRecord> temp(count);
+    while(bounds.size() > 2)
+    {
+        std::vector<std::size_t> merged;
+        threads.clear();
+        for(std::size_t n = 0; n+1 < bounds.size(); n += 2)
+        {
+            merged.push_back(bounds[n]);
+            if(n+2 >= bounds.size())
             {
-                case 'c': Result = GetNameAttr(me.Stat, NameOnly(me.Name)) - GetNameAttr(other.Stat, NameOnly(other.Name)); break;
-                case 'C': Result = GetNameAttr(other.Stat, NameOnly(other.Name)) - GetNameAttr(me.Stat, NameOnly(me.Name)); break;
-                case 'e': Result = me.Name.size() - other.Name.size(); break;
-                case 'E': Result = other.Name.size() - me.Name.size(); break;
-                case 'n': Result = strcmp(me.Name.c_str(), other.Name.c_str()); break;
-                case 'N': Result = strcmp(other.Name.c_str(), me.Name.c_str()); break;
-                case 'm': Result = strcasecmp(me.Name.c_str(), other.Name.c_str()); break;
-                case 'M': Result = strcasecmp(other.Name.c_str(), me.Name.c_str()); break;
-                case 's': Result = me.Stat.st_size - other.Stat.st_size; break;
-                case 'S': Result = other.Stat.st_size - me.Stat.st_size; break;
-                case 'd':
-                    switch(DateTime)
-                    {
-                        case 1: Result = me.Stat.st_atime-other.Stat.st_atime; break;
-                        case 2: Result = me.Stat.st_mtime-other.Stat.st_mtime; break;
-                        case 3: Result = me.Stat.st_ctime-other.Stat.st_ctime;
-                    }
-                    break;
-                case 'D':
-                    switch(DateTime)
-                    {
-                        case 1: Result = other.Stat.st_atime-me.Stat.st_atime; break;
-                        case 2: Result = other.Stat.st_mtime-me.Stat.st_mtime; break;
-                        case 3: Result = other.Stat.st_ctime-me.Stat.st_ctime;
-                    }
-                    break;
-                case 'u': Result = (int)me.Stat.st_uid - (int)other.Stat.st_uid; break;
-                case 'U': Result = (int)other.Stat.st_uid - (int)me.Stat.st_uid; break;
-                case 'g': Result = (int)me.Stat.st_gid - (int)other.Stat.st_gid; break;
-                case 'G': Result = (int)other.Stat.st_gid - (int)me.Stat.st_gid; break;
-                case 'h': Result = (int)me.Stat.st_nlink - (int)other.Stat.st_nlink; break;
-                case 'H': Result = (int)other.Stat.st_nlink - (int)me.Stat.st_nlink; break;
-                case 'r': Result = me.Class(0) - other.Class(0); break;
-                case 'R': Result = other.Class(0) - me.Class(0); break;
-                case 'p': Result = me.Class(1) - other.Class(1); break;
-                case 'P': Result = other.Class(1) - me.Class(1); break;
-                default:
-                {
-                    const char *t = Sorting.c_str();
-                    SetAttr(GetDescrColor(ColorDescr::TEXT, 1));
-                    Gprintf("\nError: `-o");
-                    while(*t != c)Gputch(*t++);
-                    GetModeColor(ColorMode::INFO, '?');
-                    Gputch(*t++);
-                    SetAttr(GetDescrColor(ColorDescr::TEXT, 1));
-                    Gprintf("%s'\n\n", t);
-                    return (Sorting = ""), 0;
-                }
+                // The odd one out is just copied
+                std::copy(&Records[bounds[n]], &Records[0] + bounds[n+1], &temp[bounds[n]]);
+                continue;
             }
-            if(Result) return Result < 0;
+            threads.emplace_back([&, n]
+            {
+                std::merge(&Records[0] + bounds[n],   &Records[0] + bounds[n+1],
+                           &Records[0] + bounds[n+1], &Records[0] + bounds[n+2],
+                           &temp[bounds[n]]);
+            });
         }
-        return false;
+        merged.push_back(count);
+        for(auto& t: threads) t.join();
+        Records.swap(temp);
+        bounds.swap(merged);
     }
-};
+}
+#endif
+
+// SortFiles: Sorts the files by their sort keys. Files with equal keys
+// stay in their original order.
+static void SortFiles(std::vector<StatItem>& f)
+{
+    if(f.size() < 2 || !CompileSortPlan()) return;
+
+    std::vector<SortRecord> Records(f.size());
+    std::vector<std::string> Keys(1);
+#ifdef HAVE_STD_THREAD
+    unsigned num_threads = std::max(StatJobs, std::thread::hardware_concurrency());
+    num_threads = std::min<std::size_t>(num_threads, f.size() / (ParallelSortThreshold / 4));
+    if(f.size() >= ParallelSortThreshold && num_threads > 1)
+        SortRecordsParallel(f, Records, Keys, num_threads);
+    else
+#endif
+    {
+        MakeSortRecords(f, 0, f.size(), Keys[0], &Records[0]);
+        std::sort(Records.begin(), Records.end());
+    }
+
+    std::vector<StatItem> sorted;
+    sorted.reserve(f.size());
+    for(const auto& r: Records) sorted.push_back(std::move(f[r.Index]));
+    f.swap(sorted);
+}
 
 static std::vector<StatItem> CollectedFilesForCurrentDirectory;
+static NameArena CollectedNames;
+
+/* With -t, the sort keys of the collected files are kept in a heap,
+ * where the last of them in the sort order is on top. Slot tells
+ * which file it is, and Seq tells which came first.
+ */
+struct TopKey
+{
+    std::string Key;
+    std::size_t Seq, Slot;
+
+    bool operator< (const TopKey& b) const
+    {
+        int c = Key.compare(b.Key);
+        if(c) return c < 0;
+        return Seq < b.Seq;
+    }
+};
+static std::vector<TopKey> TopKeys;
+static std::size_t TopSeq = 0;
 
 static std::size_t CalculateRowWidth(const Estimation& estimation, bool file_too)
 {
@@ -674,53 +1163,181 @@ static void ResetEstimations()
     if(!PreScan) EstimateFields();
 }
 
-static void UpdateEstimations(Estimation& Limits, const std::string& name, const StatType& Stat)
+// UpdateEstimations: Measures the file, and renders its text fields into row Row of Cells.
+static void UpdateEstimations(Estimation& Limits, const std::string& name, const StatType& Stat,
+                              CellCache& Cells, std::size_t Row)
 {
-    if(!S_ISDIR(Stat.st_mode)) Inodemap.insert(Stat.st_dev, Stat.st_ino, name);
+    Inodemap.insert(Stat, name);
 
     if(FieldsToPrint.used[FieldInfo::name])
     {
-        const char *hardlinkfn = Inodemap.get(Stat.st_dev, Stat.st_ino);
+        const char *hardlinkfn = Inodemap.get(Stat);
         if(hardlinkfn && name == hardlinkfn) hardlinkfn = nullptr;
-        Limits.Name = std::max(Limits.Name, std::size_t(GetName(name, Stat, 0, false, true, hardlinkfn)));
+        Limits.Name = std::max(Limits.Name, std::size_t(Cells.PutName(Row, name, Stat, hardlinkfn)));
     }
 
-    if(FieldsToPrint.used[FieldInfo::size])
-        Limits.Size = std::max(Limits.Size, GetSize(name, Stat, 0, 0).size());
-
-    if(FieldsToPrint.used[FieldInfo::size_compact])
-        Limits.SizeCompact  = std::max(Limits.SizeCompact,  GetSize(name, Stat, 0, -1).size());
-
-    if(FieldsToPrint.used[FieldInfo::size_sep])
-        Limits.SizeWithSeps = std::max(Limits.SizeWithSeps, GetSize(name, Stat, 0, '\'').size());
-
-    if(FieldsToPrint.used[FieldInfo::nrlinks])
-        Limits.Links = std::max(Limits.Links, std::to_string(Stat.st_nlink).size());
+    auto size = [&](unsigned type, int Seps, std::size_t& limit)
+    {
+        if(!Cells.Used(type)) return;
+        ColorDescr descr;
+        std::string text = RenderSize(name, Stat, Seps, descr);
+        limit = std::max(limit, text.size());
+        Cells.Put(Row, type, text, descr, 1);
+    };
+    size(FieldInfo::size,         0,                 Limits.Size);
+    size(FieldInfo::size_compact, -1,                Limits.SizeCompact);
+    size(FieldInfo::size_sep,     Cells.SizeSeps(),  Limits.SizeWithSeps);
+
+    if(Cells.Used(FieldInfo::nrlinks))
+    {
+        std::string Links = std::to_string(Stat.st_nlink);
+        Limits.Links = std::max(Limits.Links, Links.size());
+        Cells.Put(Row, FieldInfo::nrlinks, Links, ColorDescr::NRLINK, 1);
+    }
 
-    if(FieldsToPrint.used[FieldInfo::user_id] || FieldsToPrint.used[FieldInfo::user_name])
+    if(Cells.Used(FieldInfo::user_id) || Cells.Used(FieldInfo::user_name))
     {
+        if(MyUid<0) MyUid=getuid();
+        int index = ((int)Stat.st_uid==MyUid)?1:2;
         std::string Passwd = Getpwuid(Stat.st_uid);
         std::string OwNum = std::to_string(Stat.st_uid);
-        Limits.UIDname   = std::max(Limits.UIDname, Passwd.empty() ? OwNum.size() : Passwd.size());
+        if(Passwd.empty()) Passwd = OwNum;
+        Limits.UIDname   = std::max(Limits.UIDname, Passwd.size());
         Limits.UIDnumber = std::max(Limits.UIDnumber, OwNum.size());
+        if(Cells.Used(FieldInfo::user_name)) Cells.Put(Row, FieldInfo::user_name, Passwd, ColorDescr::OWNER, index);
+        if(Cells.Used(FieldInfo::user_id))   Cells.Put(Row, FieldInfo::user_id,   OwNum,  ColorDescr::OWNER, index);
     }
-    if(FieldsToPrint.used[FieldInfo::group_id] || FieldsToPrint.used[FieldInfo::group_name])
+    if(Cells.Used(FieldInfo::group_id) || Cells.Used(FieldInfo::group_name))
     {
+        if(MyGid<0) MyGid=getgid();
+        int index = ((int)Stat.st_gid==MyGid)?1:2;
         std::string Group = Getgrgid(Stat.st_gid);
         std::string GrNum = std::to_string(Stat.st_gid);
-        Limits.GIDname   = std::max(Limits.GIDname, Group.empty() ? GrNum.size() : Group.size());
+        if(Group.empty()) Group = GrNum;
+        Limits.GIDname   = std::max(Limits.GIDname, Group.size());
         Limits.GIDnumber = std::max(Limits.GIDnumber, GrNum.size());
+        if(Cells.Used(FieldInfo::group_name)) Cells.Put(Row, FieldInfo::group_name, Group, ColorDescr::GROUP, index);
+        if(Cells.Used(FieldInfo::group_id))   Cells.Put(Row, FieldInfo::group_id,   GrNum, ColorDescr::GROUP, index);
     }
 }
 
+/* The field widths of each file, for finding the widest ones in any
+ * range of files quickly. The files are divided into blocks, and the
+ * widest ones of the blocks are kept in a sparse table, where
+ * Levels[k][b] covers the blocks b..b+2^k-1. Any range is then
+ * covered by two entries of the table, plus the files at its ends
+ * that do not fill a whole block.
+ */
+class WidthTable
+{
+    static constexpr std::size_t Estimation::* Fields[] =
+    {
+        &Estimation::Name, &Estimation::Size, &Estimation::SizeWithSeps,
+        &Estimation::SizeCompact, &Estimation::UIDname, &Estimation::UIDnumber,
+        &Estimation::GIDname, &Estimation::GIDnumber, &Estimation::Links
+    };
+    static const unsigned NumFields = sizeof(Fields) / sizeof(*Fields);
+    static const std::size_t BlockSize = 64;
+
+    struct Widths
+    {
+        std::uint16_t w[NumFields] = {};
+
+        void Max(const Widths& b)
+        {
+            for(unsigned n=0; n<NumFields; ++n) w[n] = std::max(w[n], b.w[n]);
+        }
+    };
+    std::vector<Widths> Items;
+    std::vector<std::vector<Widths>> Levels;
+
+public:
+    // Measures the files, in order, with UpdateEstimations(),
+    // which also renders them into Cells.
+    WidthTable(const std::vector<StatItem>& f, CellCache& Cells) : Items(f.size()), Levels()
+    {
+        std::string path;
+        for(std::size_t a=0; a<f.size(); ++a)
+        {
+            Estimation e;
+            f[a].GetPath(path);
+            UpdateEstimations(e, path, f[a].Expand(), Cells, a);
+            for(unsigned n=0; n<NumFields; ++n)
+                Items[a].w[n] = std::min<std::size_t>(e.*Fields[n], 0xFFFF);
+        }
+
+        std::size_t num_blocks = (Items.size() + BlockSize-1) / BlockSize;
+        Levels.emplace_back(num_blocks);
+        for(std::size_t a=0; a<Items.size(); ++a)
+            Levels[0][a / BlockSize].Max(Items[a]);
+        for(std::size_t k=1; (std::size_t(1) << k) <= num_blocks; ++k)
+        {
+            const auto& prev = Levels[k-1];
+            std::size_t half = std::size_t(1) << (k-1);
+            std::vector<Widths> level(num_blocks - 2*half + 1);
+            for(std::size_t b=0; b<level.size(); ++b)
+            {
+                level[b] = prev[b];
+                level[b].Max(prev[b + half]);
+            }
+            Levels.push_back(std::move(level));
+        }
+    }
+
+    // Returns the widest ones in the files begin..end-1.
+    Estimation Widest(std::size_t begin, std::size_t end) const
+    {
+        Widths result;
+        std::size_t first = (begin + BlockSize-1) / BlockSize, last = end / BlockSize;
+        if(first >= last)
+            for(std::size_t a=begin; a<end; ++a) result.Max(Items[a]);
+        else
+        {
+            for(std::size_t a=begin; a<first*BlockSize; ++a) result.Max(Items[a]);
+            for(std::size_t a=last*BlockSize; a<end; ++a) result.Max(Items[a]);
+            std::size_t k = 0;
+            while((std::size_t(2) << k) <= last-first) ++k;
+            result.Max(Levels[k][first]);
+            result.Max(Levels[k][last - (std::size_t(1) << k)]);
+        }
+        Estimation e;
+        for(unsigned n=0; n<NumFields; ++n) e.*Fields[n] = result.w[n];
+        return e;
+    }
+};
+
 static void PrintAllFilesCollectedSoFar()
 {
     auto& f = CollectedFilesForCurrentDirectory;
 
-    if(!Sorting.empty())
-        std::sort(f.begin(), f.end());
+    if(!TopKeys.empty())
+    {
+        // With -t, the keys are already made
+        std::sort_heap(TopKeys.begin(), TopKeys.end());
+        std::vector<StatItem> sorted;
+        sorted.reserve(f.size());
+        for(const auto& k: TopKeys) sorted.push_back(std::move(f[k.Slot]));
+        f.swap(sorted);
+        TopKeys.clear();
+    }
+    else if(!Sorting.empty())
+        SortFiles(f);
+
+    if(Records != RecordFormat::none)
+    {
+        std::string path;
+        for(const StatItem& i: f)
+        {
+            i.GetPath(path);
+            PrintRecord(path, i.Expand(), i.Date);
+        }
+        f.clear();
+        CollectedNames.Clear();
+        return;
+    }
 
     EstimateFields();
+    RenderedCells.Clear();
 
     if(Colors && !f.empty() && AnsiOpt) Gprintf("\r");
     CurrentColumn = 0;
@@ -731,31 +1348,28 @@ static void PrintAllFilesCollectedSoFar()
         // Try to get the shortest number of lines.
 
         // Using binary search, find the shortest number of lines
-        // where printing still works.
+        // where printing still works. The widths of the files are
+        // measured only once, and each try looks at whole columns.
+        WidthTable widths(f, RenderedCells);
         unsigned columns = 0;
-        auto acceptable = [&f,&columns](unsigned lines)
+        auto acceptable = [&f,&columns,&widths](unsigned lines)
         {
             Longest.clear();
-            unsigned column = 1, line = 0, total_width = 0;
+            unsigned column = 0, total_width = 0;
             //printf("Trying %u lines\n", lines);
-            for(unsigned a=0; a<f.size(); ++a)
+            for(std::size_t begin = 0; begin < f.size(); begin += lines)
             {
-                if(line == 0) Longest.emplace_back(); // add column
-                UpdateEstimations(Longest.back(), f[a].Name, f[a].Stat);
+                Longest.push_back(widths.Widest(begin, std::min<std::size_t>(begin + lines, f.size())));
                 unsigned width = CalculateRowWidth(Longest.back(), true);
-                //printf("item %u on line %u column %u: column width now %u+%u\n", a, line,column, total_width, width);
-                if(total_width + width >= unsigned(COLS-1) && column > 1)
+                //printf("column %u: column width now %u+%u\n", column, total_width, width);
+                if(total_width + width >= unsigned(COLS-1) && column > 0)
                 {
                     // This number of columns does not work.
                     //printf("%u lines does not work at %u columns\n", lines,columns);
                     return false;
                 }
-                if(++line >= lines)
-                {
-                    total_width += width;
-                    line = 0;
-                    ++column;
-                }
+                total_width += width;
+                ++column;
             }
             //printf("%u lines works at %u columns\n", lines,column);
             columns = column;
@@ -778,13 +1392,15 @@ static void PrintAllFilesCollectedSoFar()
         //printf("Successful choice at %u lines, %u columns\n", lines, columns);
         Dumping = true;
         RowLen=0;
+        std::string path;
         for(unsigned line=0; line<lines; ++line)
         {
             for(unsigned c=0; c<columns; ++c)
             {
                 if(line + c*lines >= f.size()) break;
                 StatItem& tmp = f[line + c*lines];
-                TellMe(tmp.Stat, std::move(tmp.Name)
+                tmp.GetPath(path);
+                TellMe(tmp.Expand(), path, RenderedCells, line + c*lines
                 #ifdef DJGPP
                        , tmp.dosattr
                 #endif
@@ -796,15 +1412,21 @@ static void PrintAllFilesCollectedSoFar()
     }
     else
     {
-        for(StatItem& tmp: f)
-            UpdateEstimations(Longest.front(), tmp.Name, tmp.Stat);
+        std::string path;
+        for(std::size_t a=0; a<f.size(); ++a)
+        {
+            f[a].GetPath(path);
+            UpdateEstimations(Longest.front(), path, f[a].Expand(), RenderedCells, a);
+        }
         EstimateFields(); // Make sure the file name remains clipped
 
         RowLen=0;
         Dumping = true;
-        for(StatItem& tmp: f)
+        for(std::size_t a=0; a<f.size(); ++a)
         {
-            TellMe(tmp.Stat, std::move(tmp.Name)
+            StatItem& tmp = f[a];
+            tmp.GetPath(path);
+            TellMe(tmp.Expand(), path, RenderedCells, a
             #ifdef DJGPP
                    , tmp.dosattr
             #endif
@@ -814,55 +1436,149 @@ static void PrintAllFilesCollectedSoFar()
     }
 
     f.clear();
+    CollectedNames.Clear();
+    RenderedCells.Clear();
 }
 
-static void SingleFile(string&& Buffer)
+#ifndef S_ISLNK
+static const int Links = 0;
+#endif
+
+// AddFile: Puts a file, whose stat was successfully read, into the listing.
+// Dir is the path up to and including the last slash.
+static void AddFile(std::string_view Dir, std::string_view Name, const StatType& Stat)
 {
-    #ifndef S_ISLNK
-    int Links=0;
-    #endif
+    StopIfInterrupted();
+
+    // The whole path, where it is needed at once
+    static std::string Buffer;
+    auto MakePath = [&]() -> const std::string&
+    {
+        Buffer.assign(Dir);
+        Buffer += Name;
+        return Buffer;
+    };
 
     #ifdef DJGPP
     struct ffblk Bla;
-    if(findfirst(Buffer.c_str(), &Bla, 0x37))
+    if(findfirst(MakePath().c_str(), &Bla, 0x37))
     {
         if(Buffer[0]=='.')return;
         Gprintf("%s - findfirst() error: %d (%s)\n", Buffer.c_str(), errno, GetError(errno).c_str());
     }
     #endif
 
-    StatType Stat;
-    #ifdef S_ISLNK
-    if(Links ? (LStatFunc(Buffer.c_str(), &Stat) == -1)
-             : (StatFunc(Buffer.c_str(), &Stat) == -1))
-        Gprintf("%s: %s (%d)\n", Buffer, GetError(errno), errno);
-    #else
-    if(LStatFunc(Buffer.c_str(), &Stat) == -1))
-        Gprintf("%s: %s (%d)\n", Buffer, GetError(errno), errno);
-    #endif
-    else
+    if(!StatFilterPasses(Stat, FileDate(Stat))) return;
+
+    if(PreScan && TopCount)
     {
-        if(PreScan)
+        // Keep only the first TopCount items in the sort order.
+        // The rest only go in the totals.
+        auto& f = CollectedFilesForCurrentDirectory;
+        StatItem item(Stat,
+            #ifdef DJGPP
+                      Bla.ff_attrib,
+            #endif
+                      CollectedNames, Dir, Name);
+        TopKey key{std::string(), TopSeq++, f.size()};
+        if(CompileSortPlan()) MakeSortKey(key.Key, item);
+        if(f.size() < TopCount)
         {
-            CollectedFilesForCurrentDirectory.emplace_back(
-                Stat,
-                #ifdef DJGPP
-                Bla.ff_attrib,
-                #endif
-                std::move(Buffer));
+            f.push_back(std::move(item));
+            TopKeys.push_back(std::move(key));
+            std::push_heap(TopKeys.begin(), TopKeys.end());
+        }
+        else if(key < TopKeys.front())
+        {
+            std::pop_heap(TopKeys.begin(), TopKeys.end());
+            key.Slot = TopKeys.back().Slot;
+            CountFile(f[key.Slot].Expand());
+            f[key.Slot] = std::move(item);
+            TopKeys.back() = std::move(key);
+            std::push_heap(TopKeys.begin(), TopKeys.end());
         }
         else
+            CountFile(item.Expand());
+
+        // The names of the files that were dropped are still in the arena.
+        // When there are many of them, copy the kept ones into a new one.
+        if(CollectedNames.size() >= 2*f.size() + 4096)
         {
-            Dumping = true;
-            UpdateEstimations(Longest.front(), Buffer, Stat);
-            TellMe(Stat, std::move(Buffer)
-                   #ifdef DJGPP
-                   , attr
-                   #endif
-                  );
-            Dumping = false;
+            NameArena Names;
+            for(StatItem& i: f) i.MoveTo(Names);
+            std::swap(CollectedNames, Names);
         }
     }
+    else if(PreScan)
+    {
+        CollectedFilesForCurrentDirectory.emplace_back(
+            Stat,
+            #ifdef DJGPP
+            Bla.ff_attrib,
+            #endif
+            CollectedNames, Dir, Name);
+    }
+    else if(TopCount && DumpedCount >= TopCount)
+    {
+        CountFile(Stat);
+    }
+    else if(Records != RecordFormat::none)
+    {
+        ++DumpedCount;
+        PrintRecord(MakePath(), Stat, FileDate(Stat));
+    }
+    else
+    {
+        ++DumpedCount;
+        Dumping = true;
+        RenderedCells.Clear();
+        UpdateEstimations(Longest.front(), MakePath(), Stat, RenderedCells, 0);
+        TellMe(Stat, Buffer, RenderedCells, 0
+               #ifdef DJGPP
+               , Bla.ff_attrib
+               #endif
+              );
+        Dumping = false;
+    }
+}
+
+// ErrorPrintf: Errors are printed in the listing, but not among records.
+template<typename... Args>
+static void ErrorPrintf(std::string_view fmt, Args&&... args)
+{
+    if(Records == RecordFormat::none)
+        Gprintf(fmt, std::forward<Args>(args)...);
+    else
+    {
+        // Keep the error after the records printed before it
+        Gflush();
+        std::fputs(Printf(fmt, std::forward<Args>(args)...).c_str(), stderr);
+    }
+}
+
+static void StatError(const string& Buffer, int e)
+{
+    ErrorPrintf("%s: %s (%d)\n", Buffer, GetError(e), e);
+}
+
+// AddBatch: Lists the results of ScanEntries() or StatBatch().
+static void AddBatch(std::vector<StatRequest>& Batch)
+{
+    for(StatRequest& r: Batch)
+        if(r.Error)
+            StatError(r.Path(), r.Error);
+        else
+            AddFile(*r.Dir, r.Name, r.Stat);
+}
+
+// SingleFile: Lists the file, the path of which is in Buffer.
+static void SingleFile(const string& Buffer)
+{
+    StatType Stat;
+    if(StatAt(AT_FDCWD, {}, Buffer.c_str(), &Stat, !Links) == -1)
+        StatError(Buffer, errno);
+    else
+        AddFile(DirOnly(Buffer), NameOnly(Buffer), Stat);
 }
 
 static void DirChangeCheck(std::string_view Source)
@@ -899,15 +1615,62 @@ static void DirChangeCheck(std::string_view Source)
             Gprintf(" Directory of %s\n", Source.empty() ? "/" : Source);
         }
         CurrentColumn = 0;
+        DumpedCount = 0;
         LastDir = Source;
     }
 }
 
-// ScanDir: Called with parameter = the verbatim string passed on commandline.
-// Will not call recursively.
-static void ScanDir(std::string&& Source) // Directory to list
+// ListTree: Lists the directory and everything under it, depth-first.
+// The subdirectories are listed in the same order as in their parent.
+static void ListTree(DirTree& Tree, DirNode& Node)
 {
-    DIR *dir = nullptr;
+    Tree.Get(Node);
+
+    if(Node.OpenError)
+        ErrorPrintf("\n%s - error: %d (%s)\n", Node.Path,
+                    Node.OpenError, GetError(Node.OpenError));
+    else
+    {
+        DirChangeCheck(Node.Path);
+        AddBatch(Node.Entries);
+        if(Node.CloseError)
+            ErrorPrintf("\nclosedir(%s) - error: %d (%s)\n", Node.Path,
+                        Node.CloseError, GetError(Node.CloseError));
+    }
+
+    std::vector<std::shared_ptr<DirNode>> Subdirs = std::move(Node.Subdirs);
+    Tree.Release(Node);
+
+    if(!Sorting.empty() && CompileSortPlan())
+    {
+        NameArena Names;
+        std::vector<StatItem> Items;
+        for(const auto& s: Subdirs)
+            Items.emplace_back(s->Stat,
+                #ifdef DJGPP
+                               0,
+                #endif
+                               Names, DirOnly(s->Path), NameOnly(s->Path));
+        std::string Keys;
+        std::vector<SortRecord> Records(Items.size());
+        MakeSortRecords(Items, 0, Items.size(), Keys, Records.data());
+        std::sort(Records.begin(), Records.end());
+        for(const auto& r: Records)
+            ListTree(Tree, *Subdirs[r.Index]);
+    }
+    else
+        for(const auto& s: Subdirs)
+            ListTree(Tree, *s);
+}
+
+enum class ArgKind { File, Directory, Failed };
+
+// OpenArg: Finds out whether the commandline argument Source
+// is listed as a file or as a directory. Opens the directory.
+// If it fails, Error is the errno value.
+static ArgKind OpenArg(std::string& Source, DirReader& dir, int& Error)
+{
+    bool opened = false;
 
     #ifdef DJGPP
     if(!Source.empty() && Source.back() == ':')
@@ -916,7 +1679,7 @@ static void ScanDir(std::string&& Source) // Directory to list
 
     // Was null. It was not a directory, or could not be read.
     // Or, when we're not supposed to read its contents
-    if(!Contents || ((dir = opendir(Source.c_str())) == NULL
+    if(!Contents || (!(opened = dir.Open(Source))
     && (
     #if defined(DJGPP) || (defined(SUNOS)||defined(__sun)||defined(SOLARIS))
         errno==EACCES  ||
@@ -927,45 +1690,162 @@ static void ScanDir(std::string&& Source) // Directory to list
       )))
     {
         // Then list it as a file.
-        if(dir) closedir(dir);
+        dir.Close();
+        return ArgKind::File;
+    }
 
-        std::string_view Tmp = DirOnly(Source);
-        if(Tmp.empty()) Tmp = "./";
-        DirChangeCheck(Tmp);
+    if(!opened && (Source.empty() || Source.back() != '/'))
+    {
+        opened = dir.Open(Source + "/");
+    }
 
-        SingleFile(std::move(Source));
-        return;
+    if(!opened)
+    {
+        Error = errno;
+        return ArgKind::Failed;
     }
+    return ArgKind::Directory;
+}
+
+// FileChangeCheck: DirChangeCheck() for a file given on commandline.
+static void FileChangeCheck(std::string_view Source)
+{
+    std::string_view Tmp = DirOnly(Source);
+    if(Tmp.empty()) Tmp = "./";
+    DirChangeCheck(Tmp);
+}
+
+static void OpenError(const std::string& Source, int Error)
+{
+    ErrorPrintf("\n%s - error: %d (%s)\n", Source,
+                Error, GetError(Error));
+}
+static void CloseError(const std::string& Source, int Error)
+{
+    ErrorPrintf("\nclosedir(%s) - error: %d (%s)\n", Source,
+                Error, GetError(Error));
+}
 
-    if(!dir && (Source.empty() || Source.back() != '/'))
+// ScanDir: Called with parameter = the verbatim string passed on commandline.
+// Calls ListTree() for the subdirectories when Recursive.
+static void ScanDir(std::string&& Source) // Directory to list
+{
+    DirReader dir;
+    int Error = 0;
+
+    switch(OpenArg(Source, dir, Error))
     {
-        dir = opendir((Source + "/").c_str());
+        case ArgKind::File:
+            FileChangeCheck(Source);
+            SingleFile(Source);
+            return;
+        case ArgKind::Failed:
+            OpenError(Source, Error);
+            return;
+        case ArgKind::Directory:
+            break;
     }
 
-    if(!dir)
+    // Directory successfully opened.
+    if(Recursive)
     {
-        Gprintf("\n%s - error: %d (%s)\n", Source,
-                errno, GetError(errno));
+        // The subdirectories are read ahead by a pool of threads,
+        // which take work from each other as they run out of it.
+        // The listing itself is still produced by this thread alone,
+        // in the same order every time.
+        dir.Close();
+        DirTree Tree(ShowDotFiles, !Links, StatJobs);
+        ListTree(Tree, *Tree.Root(Source));
         return;
     }
 
-    // Directory successfully opened.
     DirChangeCheck(std::string(Source)); // Operates on a copy of Source
 
-    for(struct dirent *ent = readdir(dir); ent != NULL; ent = readdir(dir))
+    // The entries are stat'ed relative to the directory descriptor,
+    // so the kernel does not need to walk the path again for each file.
+    // They are stat'ed in batches, so that the requests can be
+    // in flight simultaneously. The results are handled in the
+    // order the entries were read.
+    NameArena Names;
+    ScanCached(dir, Source, ShowDotFiles, !Links, Names, [&Names](std::vector<StatRequest>& Batch)
     {
-        if(!ShowDotFiles && ent->d_name[0] == '.') continue;
+        AddBatch(Batch);
+        Names.Clear(); // AddFile() copied what it keeps
+    });
+
+    if(dir.Close() != 0)
+        CloseError(Source, errno);
+}
+
+// ArgListing: ScanDir() split in two, for reading several
+// commandline arguments at the same time. ReadArg() does
+// everything but the output, and may be called in any thread.
+// PrintArg() then lists what was found.
+struct ArgListing
+{
+    std::string Source;
+    ArgKind     Kind  = ArgKind::Failed;
+    int         Error = 0; // Failed: open error. Directory: closedir error.
+    std::vector<StatRequest> Entries{}; // For a file, the file itself.
+    NameArena                Names{};   // Of the Entries
+};
 
-        std::string Buffer = Source;
-        if(Buffer.back() != '/') Buffer += '/';
-        Buffer += ent->d_name;
+static void ReadArg(ArgListing& Arg)
+{
+    DirReader dir;
+    Arg.Kind = OpenArg(Arg.Source, dir, Arg.Error);
+    if(Arg.Kind == ArgKind::File)
+    {
+        auto [d, n] = Arg.Names.Add(DirOnly(Arg.Source), NameOnly(Arg.Source));
+        StatRequest r{d, n};
+        if(StatAt(AT_FDCWD, *r.Dir, r.Name.data(), &r.Stat, !Links) == -1) r.Error = errno;
+        Arg.Entries.push_back(std::move(r));
+    }
+    else if(Arg.Kind == ArgKind::Directory)
+    {
+        ScanCached(dir, Arg.Source, ShowDotFiles, !Links, Arg.Names, [&Arg](std::vector<StatRequest>& Batch)
+        {
+            std::move(Batch.begin(), Batch.end(), std::back_inserter(Arg.Entries));
+        });
+        if(dir.Close() != 0) Arg.Error = errno;
+    }
+}
 
-        SingleFile(std::move(Buffer));
+static void PrintArg(ArgListing& Arg)
+{
+    switch(Arg.Kind)
+    {
+        case ArgKind::File:
+            FileChangeCheck(Arg.Source);
+            AddBatch(Arg.Entries);
+            break;
+        case ArgKind::Failed:
+            OpenError(Arg.Source, Arg.Error);
+            break;
+        case ArgKind::Directory:
+            DirChangeCheck(std::string(Arg.Source));
+            AddBatch(Arg.Entries);
+            if(Arg.Error) CloseError(Arg.Source, Arg.Error);
+            break;
     }
+    std::vector<StatRequest>().swap(Arg.Entries);
+    Arg.Names = NameArena();
+}
 
-    if(closedir(dir) != 0)
-        Gprintf("\nclosedir(%s) - error: %d (%s)\n", Source,
-                errno, GetError(errno));
+// ReadInput: Lists the files that --format=columnar wrote into InputFile.
+// The filesystem is not looked at.
+static void ReadInput()
+{
+    int Error = ReadColumnar(InputFile, [](std::string_view Path, const StatType& Stat)
+    {
+        std::string_view Name = NameOnly(Path);
+        if(!ShowDotFiles && !Name.empty() && Name[0] == '.') return;
+        if(!NameFilterPasses(Name)) return;
+
+        FileChangeCheck(Path);
+        AddFile(DirOnly(Path), NameOnly(Path), Stat);
+    });
+    if(Error) OpenError(InputFile, Error);
 }
 
 static std::list<std::string> FilesToList_FromCommandline;
@@ -975,9 +1855,26 @@ static void DumpDirs()
     // Reset the estimations for field widths
     ResetEstimations();
 
+    if(!InputFile.empty())
+        ReadInput();
     // For each file that was listed on the commandline:
-    for(std::string& s: FilesToList_FromCommandline)
-        ScanDir( std::move(s) );
+    else if(FilesToList_FromCommandline.size() > 1 && !Recursive && PreScan)
+    {
+        // Read them at the same time, so that if they are on
+        // different slow mounts, their delays overlap.
+        // Print them in order, each as soon as it is ready.
+        // With -e, the files are printed while they are read,
+        // so they are read in order instead of kept in memory.
+        std::vector<ArgListing> Args;
+        for(std::string& s: FilesToList_FromCommandline)
+            Args.push_back({std::move(s)});
+        ReadAhead(Args.size(),
+                  [&Args](std::size_t n) { ReadArg(Args[n]); },
+                  [&Args](std::size_t n) { PrintArg(Args[n]); });
+    }
+    else
+        for(std::string& s: FilesToList_FromCommandline)
+            ScanDir( std::move(s) );
 
     // Don't need these anymore
     FilesToList_FromCommandline.clear();
@@ -1017,11 +1914,38 @@ private:
         return s.substr(p-q);
     }
 #endif
+#ifdef HAVE_STD_THREAD
+    std::string opt_j(const std::string &s)
+    {
+        const char *q = s.c_str();
+        const char *p = q;
+        long v = strtol(p, const_cast<char**>(&p), 10);
+        if(v < 1 || v > 1024) argerror(s);
+        StatJobs = v;
+        return s.substr(p-q);
+    }
+#endif
+    std::string opt_k(const std::string &s) { DirCache = 0; return s; }
+    std::string opt_k1(const std::string &s) { DirCache = 1; return s; }
+    std::string opt_k2(const std::string &s) { DirCache = 2; return s; }
+#ifdef HAVE_IO_URING_STATX
+    std::string opt_U(const std::string &s) { UseStatRing = false; return s; }
+    std::string opt_U1(const std::string &s) { UseStatRing = true; return s; }
+#endif
+    std::string opt_t(const std::string &s)
+    {
+        const char *q = s.c_str();
+        const char *p = q;
+        long v = strtol(p, const_cast<char**>(&p), 10);
+        if(v < 1) argerror(s);
+        TopCount = v;
+        return s.substr(p-q);
+    }
     std::string opt_X(const std::string &s)
     {
         const char *q = s.c_str();
         const char *p = q;
-        if(*p == '0') { std::printf("Window size = %dx%d\n", COLS, LINES); }
+        if(*p == '0') { Gprintf("Window size = %dx%d\n", COLS, LINES); }
         int v = strtol(p, const_cast<char**>(&p), 10);
         if(v) COLS = v;
         return s.substr(p-q);
@@ -1041,16 +1965,31 @@ private:
     std::string opt_c(const std::string &s) { Colors = false;    return s; }
     std::string opt_C(const std::string &s) { MultiColumn = true; return s; }
     std::string opt_D(const std::string &s) { Contents = false;  return s; }
+    std::string opt_R(const std::string &s) { Recursive = true;  return s; }
     std::string opt_p(const std::string &s) { Pagebreaks = true; return s; }
     std::string opt_P(const std::string &s) { AnsiOpt = false;   return s; }
     std::string opt_e(const std::string &s) { PreScan = false; Sorting = ""; return s; }
     std::string opt_o(const std::string &s) { Sorting = s; return ""; }
     std::string opt_F(const std::string &s) { DateForm = s; return ""; }
-    std::string opt_f(const std::string &s) { FieldOrder = s; return ""; }
+    std::string opt_i(const std::string &s) { AddNameFilter(s, true); return ""; }
+    std::string opt_L(const std::string &s) { if(!ParseSize(s, StatFilter.Larger)) argerror(s); return ""; }
+    std::string opt_S(const std::string &s) { if(!ParseSize(s, StatFilter.Smaller)) argerror(s); return ""; }
+    std::string opt_n(const std::string &s) { if(!ParseAge(s, StatFilter.Newer)) argerror(s); return ""; }
+    std::string opt_N(const std::string &s) { if(!ParseAge(s, StatFilter.Older)) argerror(s); return ""; }
+    std::string opt_T(const std::string &s) { if(!ParseTypes(s)) argerror(s); return ""; }
+    std::string opt_u(const std::string &s) { if(!ParseOwner(s, StatFilter.Owner)) argerror(s); return ""; }
+    std::string opt_x(const std::string &s) { AddNameFilter(s, false); return ""; }
+    std::string opt_I(const std::string &s) { InputFile = s; return ""; }
+    std::string opt_f(const std::string &s)
+    {
+        Records = RecordFormatByName(s);
+        if(Records == RecordFormat::none) FieldOrder = s;
+        return "";
+    }
     std::string opt_vc(const std::string& s) { VerticalColumns = true; return s; }
     std::string opt_V(const std::string &)
     {
-        printf(VERSIONSTR, VERSION);
+        Gprintf(VERSIONSTR, VERSION);
         exit(0);
     }
     std::string opt_a(const std::string &s)
@@ -1215,6 +2154,8 @@ public:
                                   "  .z is .s in \"human-readable\" format\n"
                                   "   anything else=printed, except _ produces space\n"
                                   "  Colors follow the same format as in DIRR_COLORS\n"
+                                  "  json, ndjson, csv or nul prints records for programs instead\n"
+                                  "  columnar writes a binary listing for -I (layout in records.hh)\n"
                                   "   Default is `--format="+FieldOrder+"'",
                                   &Handle::opt_f);
         add("-F",  "--dates",     "Specify new date format. man strftime. Underscore (_) produces space.\n"
@@ -1224,6 +2165,30 @@ public:
         add("-H1", "--hl",        "Enables mapping hardlinks (default)", &Handle::opt_H1);
         add("-H",  "--nohl",      "Disables mapping hardlinks", &Handle::opt_H);
         add("-?",  NULL,          "Alias to -h", &Handle::opt_h);
+        add("-i",  "--include",   "List only the files whose names match the pattern.\n"
+                                  "Can be given many times. Example: --include=*.parquet\n"
+                                  "Wildcards are ? * [a-z] \\d \\w, as in byext() in DIRR_COLORS.\n"
+                                  "With -R, only the subdirectories that match are entered.",
+                                  &Handle::opt_i);
+        add("-I",  "--input",     "List the files in a file written with --format=columnar (- = stdin),\n"
+                                  "instead of reading the directories. Example: -Ilisting.bin -os",
+                                  &Handle::opt_I);
+#ifdef HAVE_STD_THREAD
+        add("-j",  "--jobs",      "Read file information using this many threads.\n"
+                                  "Helps with high-latency storage. Example: --jobs=16\n"
+                                  "Big directories are also sorted using this many threads.",
+                                  &Handle::opt_j);
+#endif
+        add("-k1", "--cache",     "Remember the names in directories in ~/.dirr_cache.\n"
+                                  "Unchanged directories are not read again, but the files are stat'ed.",
+                                  &Handle::opt_k1);
+        add("-k2", "--trust-cache", "Like -k1, but remember the file information too.\n"
+                                  "Faster, but it does not notice when files change size or times.",
+                                  &Handle::opt_k2);
+        add("-k",  "--nocache",   "Disables -k1 and -k2 (default)", &Handle::opt_k);
+        add("-L",  "--larger",    "List only the files larger than this many bytes.\n"
+                                  "k, M, G and T are powers of 1024. Example: --larger=1G",
+                                  &Handle::opt_L);
         add("-la", NULL,          "Alias to -al", &Handle::opt_al);
 #ifdef S_ISLNK
         add("-l",  "--links",     "Specify how the links are shown:\n"
@@ -1241,21 +2206,48 @@ public:
                                   " -m2: None.\n"
                                   " -m3: Compact with exact numbers.", &Handle::opt_m);
         add("-M", "--tstylsep",   "Like -m, but with a thousand separator. Example: -M0,", &Handle::opt_M);
+        add("-n",  "--newer",     "List only the files with date (see -d#) newer than this.\n"
+                                  "s, m, h, d and w are seconds, minutes, hours, days and weeks.\n"
+                                  "Example: --newer=2h",
+                                  &Handle::opt_n);
+        add("-N",  "--older",     "List only the files with date older than this. Example: -N30d",
+                                  &Handle::opt_N);
         add("-o", "--sort",       "Sort the files (disables -e), with n as combination of:\n"
                                   "  (n)ame, (s)ize, (d)ate, (u)id, (g)id, (h)linkcount,\n"
-                                  "  nam(e) length, na(m)e case insensitively, (c)olor,\n"
+                                  "  nam(e) length, na(m)e case insensitively, (c)olor (if shown),\n"
                                   "  g(r)oup dirs,files,links,chrdevs,blkdevs,fifos,socks,\n"
                                   "  grou(p) dirs,links=files,chrdevs,blkdevs,fifos,socks.\n"
                                   "Use Uppercase for reverse order.\n"
                                   "Default is `--sort="+Sorting+"'\n", &Handle::opt_o);
         add("-p",  "--paged",     "Use internal pager.", &Handle::opt_p);
         add("-P",  "--oldvt",     "Disables colour code optimizations.", &Handle::opt_P);
+        add("-R",  "--recursive", "List the subdirectories too, depth-first.", &Handle::opt_R);
         add("-r",  "--restore",   "Undoes all options, including the DIRR environment variable.", &Handle::opt_r);
+        add("-S",  "--smaller",   "List only the files smaller than this many bytes. Example: -S4k",
+                                  &Handle::opt_S);
+        add("-t",  "--top",       "List only the first N files of each directory in the sort order.\n"
+                                  "The totals still include all files. Example: -oS --top=20",
+                                  &Handle::opt_t);
+        add("-T",  "--type",      "List only the files of these types:\n"
+                                  "  (f)ile, (d)irectory, (l)ink, (p)ipe, (s)ocket,\n"
+                                  "  (c)hrdev, (b)lkdev. Example: --type=fl",
+                                  &Handle::opt_T);
+#ifdef HAVE_IO_URING_STATX
+        add("-U1", "--uring",     "Stat the files through io_uring, where the kernel supports it.\n"
+                                  "May help with big directories on slow storage.",
+                                  &Handle::opt_U1);
+        add("-U",  "--nouring",   "Disables -U1 (default)", &Handle::opt_U);
+#endif
+        add("-u",  "--owner",     "List only the files owned by this user (name or number).",
+                                  &Handle::opt_u);
         add("-vc", "--vertical",  "Uses vertical columns rather than horizontal in -C modes.", &Handle::opt_vc);
         add("-v",  "--version",   "Displays the version.", &Handle::opt_V);
         add("-V",  NULL,          "Alias to -v.", &Handle::opt_V);
         add("-w",  "--wide",      "Equal to -l1HCm1f.f -opcm -vc", &Handle::opt_w);
         add("-W",  "--ediw",      "Same as -w, but with reverse sort order.", &Handle::opt_W);
+        add("-x",  "--exclude",   "Do not list the files whose names match the pattern.\n"
+                                  "Can be given many times. Example: --exclude=*.o",
+                                  &Handle::opt_x);
         add("-X",  "--width",     "Force screen width, example: -X132. -X0 debugs autodetection.",
                                   &Handle::opt_X);
 
@@ -1314,12 +2306,15 @@ public:
 #if defined(SIGINT) || defined(SIGTERM)
 static void Term(int /*dummy*/)
 {
-    Gprintf("^C\n");
-
-    RowLen=1;
-    PrintSums();
-
-    exit(0);
+    // If the listing is stuck, for example on a slow mount,
+    // the second signal ends the program from here.
+    if(Interrupted)
+    {
+        static const char msg[] = "^C\n";
+        (void)!write(1, msg, sizeof(msg)-1);
+        _exit(0);
+    }
+    Interrupted = 1;
 }
 #endif
 
@@ -1341,10 +2336,33 @@ int main(int argc, const char *const *argv)
 
     // cute
     Handle parameters (getenv("DIRR"), argc, argv);
+    if(Records != RecordFormat::none)
+    {
+        // Nothing but the records goes into the output
+        Colors = Totals = Pagebreaks = false;
+    }
+    if(!InputFile.empty())
+    {
+        // Link targets and the names of hardlinks would need the filesystem
+        #ifdef S_ISLNK
+        if(Links >= 2) Links = (Links == 4);
+        #endif
+        Inodemap.disable();
+        // The free space of the filesystem here would not be theirs
+        FreeSpace = false;
+    }
     FieldsToPrint.ParseFrom(FieldOrder);
+    StatFields = StatFieldsNeeded();
+    Inodemap.follow_links(!Links, FilesToList_FromCommandline.size() <= 1);
+    CompileNameFilters();
+    StatFilter.SubdirsNeeded = Recursive;
+
+    // Without colors, they are not sorted by either
+    Monochrome = !Colors;
 
     Dumping = true;
     DumpDirs();
+    EndRecords();
 
     if(RowLen > 0)Gprintf("\n");
     PrintSums();
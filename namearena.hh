@@ -0,0 +1,67 @@
+#ifndef dirr3_namearena_hh
+#define dirr3_namearena_hh
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+
+/***********************************************
+ *
+ * NameArena
+ *
+ *   Storage for file names. The names are copied one after
+ *   another into big blocks, and the directory part is kept
+ *   once for each run of names in the same directory.
+ *   Each name is followed by a nul byte, so that it can
+ *   be given to the kernel as it is.
+ *   What Add() returns stays valid until Clear().
+ *
+ *     Add(Dir, Name): Dir is up to and including the last slash.
+ *     size():         The number of names added since Clear().
+ *
+ **********************************************************/
+
+class NameArena
+{
+    static constexpr std::size_t BlockSize = 64*1024;
+    std::vector<std::unique_ptr<char[]>> Blocks{};
+    std::size_t Used = BlockSize; // In the last block
+    std::deque<std::string> Dirs{};
+    std::size_t Count = 0;        // Names added since Clear()
+public:
+    NameArena() {}
+    NameArena(NameArena&&) = default;
+    NameArena& operator=(NameArena&&) = default;
+
+    std::pair<const std::string*, std::string_view> Add(std::string_view Dir, std::string_view Name)
+    {
+        if(Dirs.empty() || Dirs.back() != Dir) Dirs.emplace_back(Dir);
+        if(Used + Name.size() + 1 > BlockSize)
+        {
+            Blocks.emplace_back(new char[std::max(BlockSize, Name.size() + 1)]);
+            Used = 0;
+        }
+        char* dest = Blocks.back().get() + Used;
+        std::memcpy(dest, Name.data(), Name.size());
+        dest[Name.size()] = '\0';
+        Used += Name.size() + 1;
+        ++Count;
+        return {&Dirs.back(), std::string_view(dest, Name.size())};
+    }
+    std::size_t size() const { return Count; }
+    void Clear()
+    {
+        // Keep one block for the next directory
+        if(Blocks.size() > 1) Blocks.resize(1);
+        Used = Blocks.empty() ? BlockSize : 0;
+        Dirs.clear();
+        Count = 0;
+    }
+};
+
+#endif
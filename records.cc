@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "config.h"
+#include "records.hh"
+#include "cons.hh"
+#include "pwfun.hh"
+
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+
+RecordFormat Records = RecordFormat::none;
+
+static bool Started = false; // Whether anything has been printed yet
+static std::string Line;     // The record being made
+
+static const char CsvHeader[] = "path,type,mode,nlink,uid,gid,user,group,size,date,ino\n";
+static const char ColumnMagic[8] = {'d','i','r','r','c','o','l','s'};
+static const std::uint32_t ColumnVersion = 1;
+
+// The files of --format=columnar not yet written, one vector per column.
+static struct ColumnBlock
+{
+    std::vector<std::int64_t>  size{}, date{};
+    std::vector<std::uint64_t> ino{}, name_end{};
+    std::vector<std::uint32_t> mode{}, uid{}, gid{}, nlink{};
+    std::string                heap{};
+
+    std::size_t count() const { return mode.size(); }
+    void clear()
+    {
+        size.clear(); date.clear(); ino.clear(); name_end.clear();
+        mode.clear(); uid.clear(); gid.clear(); nlink.clear();
+        heap.clear();
+    }
+} Block;
+
+RecordFormat RecordFormatByName(std::string_view name)
+{
+    if(name == "json")   return RecordFormat::json;
+    if(name == "ndjson") return RecordFormat::ndjson;
+    if(name == "csv")    return RecordFormat::csv;
+    if(name == "nul")    return RecordFormat::nul;
+    if(name == "columnar") return RecordFormat::columnar;
+    return RecordFormat::none;
+}
+
+static const char* TypeName(mode_t m)
+{
+    if(S_ISREG(m)) return "file";
+    if(S_ISDIR(m)) return "dir";
+    #ifdef S_ISLNK
+    if(S_ISLNK(m)) return "link";
+    #endif
+    if(S_ISCHR(m)) return "chr";
+    if(S_ISBLK(m)) return "blk";
+    #ifdef S_ISFIFO
+    if(S_ISFIFO(m)) return "fifo";
+    #endif
+    #ifdef S_ISSOCK
+    if(S_ISSOCK(m)) return "sock";
+    #endif
+    return "other";
+}
+
+template<typename T>
+static void PutNumber(T value)
+{
+    char Buf[32];
+    Line.append(Buf, std::to_chars(Buf, Buf + sizeof(Buf), value).ptr);
+}
+
+static void PutMode(mode_t m)
+{
+    char Buf[4];
+    for(int n = 3; n >= 0; --n, m >>= 3) Buf[n] = char('0' + (m & 7));
+    Line.append(Buf, 4);
+}
+
+static void PutJsonString(std::string_view s)
+{
+    static const char hex[] = "0123456789abcdef";
+    Line += '"';
+    for(std::size_t a = 0; a < s.size(); )
+    {
+        unsigned char c = s[a];
+        if(c >= 0x20 && c < 0x7F && c != '"' && c != '\\')
+        {
+            Line += char(c);
+            ++a;
+            continue;
+        }
+        if(c >= 0x80)
+        {
+            auto utf8 = ParseUTF8([&](unsigned index) -> int
+            {
+                if(a+index >= s.size()) return -1;
+                return (unsigned char)s[a+index];
+            });
+            char32_t code = utf8 & 0xFFFFFFFFu;
+            unsigned length = utf8 >> 32;
+            if(utf8 && (code < 0xD800 || code > 0xDFFF) && code <= 0x10FFFF)
+            {
+                Line.append(s.data()+a, length);
+                a += length;
+            }
+            else
+            {
+                // Not UTF-8. Escape the byte as a lone surrogate.
+                Line += "\\udc";
+                Line += hex[c >> 4];
+                Line += hex[c & 15];
+                ++a;
+            }
+            continue;
+        }
+        switch(c)
+        {
+            case '"':  Line += "\\\""; break;
+            case '\\': Line += "\\\\"; break;
+            case '\n': Line += "\\n"; break;
+            case '\r': Line += "\\r"; break;
+            case '\t': Line += "\\t"; break;
+            default:
+                Line += "\\u00";
+                Line += hex[c >> 4];
+                Line += hex[c & 15];
+        }
+        ++a;
+    }
+    Line += '"';
+}
+
+static void PutCsvString(std::string_view s)
+{
+    if(s.find_first_of(",\"\r\n") == s.npos)
+    {
+        Line += s;
+        return;
+    }
+    Line += '"';
+    for(char c: s)
+    {
+        if(c == '"') Line += '"';
+        Line += c;
+    }
+    Line += '"';
+}
+
+template<typename T>
+static void PutLE(std::string& s, T value)
+{
+    for(unsigned n = 0; n < sizeof(T); ++n)
+        s += char(std::make_unsigned_t<T>(value) >> (8*n));
+}
+
+template<typename T>
+static T GetLE(const char* p)
+{
+    std::make_unsigned_t<T> value = 0;
+    for(unsigned n = 0; n < sizeof(T); ++n)
+        value |= std::make_unsigned_t<T>((unsigned char)p[n]) << (8*n);
+    return T(value);
+}
+
+template<typename T>
+static void PutColumn(const std::vector<T>& column)
+{
+    if constexpr(std::endian::native == std::endian::little)
+        GputsRaw(std::string_view((const char*)column.data(), column.size() * sizeof(T)));
+    else
+    {
+        Line.clear();
+        for(T value: column) PutLE(Line, value);
+        GputsRaw(Line);
+    }
+}
+
+static void PutColumnHeader()
+{
+    Line.assign(ColumnMagic, sizeof(ColumnMagic));
+    PutLE(Line, ColumnVersion);
+    PutLE(Line, std::uint32_t(0));
+    GputsRaw(Line);
+}
+
+// Writes the files collected in Block. If there are none, ends the file.
+static void PutColumnBlock()
+{
+    Line.clear();
+    PutLE(Line, std::uint32_t(Block.count()));
+    PutLE(Line, std::uint32_t(0));
+    PutLE(Line, std::uint64_t(Block.heap.size()));
+    GputsRaw(Line);
+
+    PutColumn(Block.size);
+    PutColumn(Block.date);
+    PutColumn(Block.ino);
+    PutColumn(Block.name_end);
+    PutColumn(Block.mode);
+    PutColumn(Block.uid);
+    PutColumn(Block.gid);
+    PutColumn(Block.nlink);
+    Block.heap.resize((Block.heap.size() + 7) & ~std::size_t(7), '\0');
+    GputsRaw(Block.heap);
+
+    Block.clear();
+}
+
+void PrintRecord(std::string_view path, const StatType& Stat, time_t date)
+{
+    Line.clear();
+    switch(Records)
+    {
+        case RecordFormat::none:
+            return;
+        case RecordFormat::columnar:
+            if(!Started) PutColumnHeader();
+            Started = true;
+            Block.heap += path;
+            Block.size.push_back(Stat.st_size);
+            Block.date.push_back(date);
+            Block.ino.push_back(Stat.st_ino);
+            Block.name_end.push_back(Block.heap.size());
+            Block.mode.push_back(Stat.st_mode);
+            Block.uid.push_back(Stat.st_uid);
+            Block.gid.push_back(Stat.st_gid);
+            Block.nlink.push_back(Stat.st_nlink);
+            if(Block.count() >= ColumnBlockSize) PutColumnBlock();
+            return;
+        case RecordFormat::nul:
+            Line += path;
+            Line += '\0';
+            break;
+        case RecordFormat::csv:
+            if(!Started) Line += CsvHeader;
+            PutCsvString(path);                   Line += ',';
+            Line += TypeName(Stat.st_mode);       Line += ',';
+            PutMode(Stat.st_mode & 07777);        Line += ',';
+            PutNumber(Stat.st_nlink);             Line += ',';
+            PutNumber(Stat.st_uid);               Line += ',';
+            PutNumber(Stat.st_gid);               Line += ',';
+            PutCsvString(Getpwuid(Stat.st_uid));  Line += ',';
+            PutCsvString(Getgrgid(Stat.st_gid));  Line += ',';
+            PutNumber((SizeType)Stat.st_size);    Line += ',';
+            PutNumber(date);                      Line += ',';
+            PutNumber(Stat.st_ino);
+            Line += '\n';
+            break;
+        case RecordFormat::json:
+            Line += Started ? ",\n" : "[\n";
+            [[fallthrough]];
+        case RecordFormat::ndjson:
+            Line += "{\"path\":";   PutJsonString(path);
+            Line += ",\"type\":\""; Line += TypeName(Stat.st_mode);
+            Line += "\",\"mode\":\""; PutMode(Stat.st_mode & 07777);
+            Line += "\",\"nlink\":"; PutNumber(Stat.st_nlink);
+            Line += ",\"uid\":";    PutNumber(Stat.st_uid);
+            Line += ",\"gid\":";    PutNumber(Stat.st_gid);
+            Line += ",\"user\":";   PutJsonString(Getpwuid(Stat.st_uid));
+            Line += ",\"group\":";  PutJsonString(Getgrgid(Stat.st_gid));
+            Line += ",\"size\":";   PutNumber((SizeType)Stat.st_size);
+            Line += ",\"date\":";   PutNumber(date);
+            Line += ",\"ino\":";    PutNumber(Stat.st_ino);
+            Line += '}';
+            if(Records == RecordFormat::ndjson) Line += '\n';
+            break;
+    }
+    Started = true;
+    GputsRaw(Line);
+}
+
+void EndRecords()
+{
+    switch(Records)
+    {
+        case RecordFormat::json:
+            GputsRaw(Started ? "\n]\n" : "[]\n");
+            break;
+        case RecordFormat::csv:
+            if(!Started) GputsRaw(CsvHeader);
+            break;
+        case RecordFormat::columnar:
+            if(!Started) PutColumnHeader();
+            if(Block.count() > 0) PutColumnBlock();
+            PutColumnBlock(); // The end
+            break;
+        default:
+            break;
+    }
+    Started = true;
+}
+
+static bool ReadFully(int fd, char* p, std::size_t n)
+{
+    while(n > 0)
+    {
+        ssize_t r = read(fd, p, n);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// Reads n bytes into data. The sizes come from the file, so the memory
+// is only taken as the bytes actually arrive, at most ReadChunk at a time.
+static bool ReadBlock(int fd, std::vector<char>& data, std::uint64_t n)
+{
+    static const std::size_t ReadChunk = 1 << 20;
+    data.clear();
+    while(data.size() < n)
+    {
+        std::size_t pos = data.size(), add = std::min<std::uint64_t>(n - pos, ReadChunk);
+        try { data.resize(pos + add); }
+        catch(const std::bad_alloc&) { return false; }
+        if(!ReadFully(fd, data.data() + pos, add)) return false;
+    }
+    return true;
+}
+
+int ReadColumnar(const std::string& fn,
+                 const std::function<void(std::string_view, const StatType&)>& use)
+{
+    int fd = fn == "-" ? 0 : open(fn.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return errno;
+
+    int result = 0;
+    char head[16];
+    if(!ReadFully(fd, head, sizeof(head))
+    || std::memcmp(head, ColumnMagic, sizeof(ColumnMagic)) != 0
+    || GetLE<std::uint32_t>(head+8) != ColumnVersion)
+        result = EINVAL;
+
+    std::vector<char> data;
+    StatType Stat;
+    std::memset(&Stat, 0, sizeof(Stat));
+    while(result == 0)
+    {
+        if(!ReadFully(fd, head, sizeof(head))) { result = EINVAL; break; }
+        std::size_t   count = GetLE<std::uint32_t>(head);
+        std::uint64_t heap  = GetLE<std::uint64_t>(head+8);
+        if(count == 0) break;
+        if(count > ColumnBlockSize || heap >= (std::uint64_t(1) << 40)) { result = EINVAL; break; }
+
+        if(!ReadBlock(fd, data, count * (4*8 + 4*4) + ((heap + 7) & ~std::uint64_t(7))))
+            { result = EINVAL; break; }
+
+        const char* size     = data.data();
+        const char* date     = size     + 8*count;
+        const char* ino      = date     + 8*count;
+        const char* name_end = ino      + 8*count;
+        const char* mode     = name_end + 8*count;
+        const char* uid      = mode     + 4*count;
+        const char* gid      = uid      + 4*count;
+        const char* nlink    = gid      + 4*count;
+        const char* names    = nlink    + 4*count;
+
+        std::uint64_t begin = 0;
+        for(std::size_t n = 0; n < count; ++n)
+        {
+            std::uint64_t end = GetLE<std::uint64_t>(name_end + 8*n);
+            if(end < begin || end > heap) { result = EINVAL; break; }
+            Stat.st_size  = GetLE<std::int64_t>(size + 8*n);
+            Stat.st_atime = Stat.st_mtime = Stat.st_ctime = GetLE<std::int64_t>(date + 8*n);
+            Stat.st_ino   = GetLE<std::uint64_t>(ino + 8*n);
+            Stat.st_mode  = GetLE<std::uint32_t>(mode + 4*n);
+            Stat.st_uid   = GetLE<std::uint32_t>(uid + 4*n);
+            Stat.st_gid   = GetLE<std::uint32_t>(gid + 4*n);
+            Stat.st_nlink = GetLE<std::uint32_t>(nlink + 4*n);
+            use(std::string_view(names + begin, end - begin), Stat);
+            begin = end;
+        }
+    }
+    if(fd != 0) close(fd);
+    return result;
+}
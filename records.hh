@@ -0,0 +1,93 @@
+#ifndef dirr3_records_hh
+#define dirr3_records_hh
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <ctime>
+
+#include "stat.h"
+
+/***********************************************
+ *
+ * Machine-readable listings (--format=json, ndjson, csv, nul, columnar)
+ *
+ *   Instead of the columns, each file is printed as a record,
+ *   straight into the output: no colours, padding or paging.
+ *   The other output, such as the totals, is left out, and
+ *   the errors go to stderr.
+ *
+ *     json:   One array of objects.
+ *     ndjson: One object on each line.
+ *     csv:    A header line, and then one line for each file.
+ *             Fields are quoted as in RFC 4180, when needed.
+ *     nul:    Nothing but the path, followed by a nul character.
+ *     columnar: Binary, in blocks of columns. See below.
+ *
+ *   The fields are: path, type (file, dir, link, chr, blk, fifo,
+ *   sock or other), mode (octal permissions, as a string), nlink,
+ *   uid, gid, user, group (empty if not known), size, date (the one
+ *   chosen with -d#, in seconds since 1970) and ino.
+ *   In json, bytes of names that are not valid UTF-8 are written
+ *   as \udc80..\udcff, like Python's "surrogateescape" does.
+ *
+ *     RecordFormatByName(name): The format, or none if it is not one.
+ *     PrintRecord(path, Stat, date): Prints one file.
+ *     EndRecords():  To be called after the last file.
+ *
+ **********************************************************/
+
+enum class RecordFormat { none, json, ndjson, csv, nul, columnar };
+
+extern RecordFormat Records;
+
+extern RecordFormat RecordFormatByName(std::string_view name);
+extern void PrintRecord(std::string_view path, const StatType& Stat, time_t date);
+extern void EndRecords();
+
+/***********************************************
+ *
+ * The columnar format (--format=columnar)
+ *
+ *   All numbers are little-endian. The file begins with:
+ *
+ *     8 bytes  "dirrcols"
+ *     uint32   version: 1
+ *     uint32   0
+ *
+ *   Then come blocks of at most ColumnBlockSize files. A block begins with:
+ *
+ *     uint32   count: the number of files in the block
+ *     uint32   0
+ *     uint64   heap: the number of bytes of names
+ *
+ *   followed by the columns, each of which has count values:
+ *
+ *     int64    size
+ *     int64    date: the one chosen with -d#, in seconds since 1970
+ *     uint64   ino
+ *     uint64   name_end: where the name of the file ends in the heap.
+ *              It begins where the previous one ended (the first at 0).
+ *     uint32   mode: st_mode, the file type and the permissions
+ *     uint32   uid
+ *     uint32   gid
+ *     uint32   nlink
+ *
+ *   and by the heap, padded with zeros to a multiple of 8 bytes, so
+ *   every column begins at a multiple of 8 bytes. The names are
+ *   the paths as listed, without nul characters. A block where
+ *   count is 0 ends the file.
+ *
+ *     ReadColumnar(fn, use): Reads such a file ("-" = stdin), and calls
+ *                use(path, stat) for each file in it. All three times
+ *                in the stat are the date, and the fields that are
+ *                not stored are zero. Returns 0, or an errno value.
+ *
+ **********************************************************/
+
+static const std::size_t ColumnBlockSize = 65536;
+
+extern int ReadColumnar(const std::string& fn,
+                        const std::function<void(std::string_view, const StatType&)>& use);
+
+#endif
@@ -31,6 +31,7 @@ using std::map;
 using std::isxdigit;
 
 bool Dumping = false; // If 0, save some time
+bool Monochrome = false; // Colors are not printed
 
 /***
  *** Settings - This is the default DIRR_COLORS
@@ -107,6 +108,9 @@ public:
     std::vector<std::vector<int>> descr_sets{};
 public:
     DFA_Matcher byext_sets{};
+    bool byext_blanks = false; // Whether some of them are blanks
+private:
+    bool byext_loaded = false;
 
 public:
     Settings() {}
@@ -261,6 +265,7 @@ private:
                         continue;
                     }
                     byext_sets.AddMatch(std::move(token), ignore_case, color);
+                    if(BlankAttr(color)) byext_blanks = true;
                     pos = spacepos;
                 }
             }
@@ -291,8 +296,16 @@ private:
                 }
             }
         }
+    }
+
+public:
+    // Load/Compile/Save byext_sets for use by NameColor()
+    void LoadByext()
+    {
+        Load();
+        if(byext_loaded) return;
+        byext_loaded = true;
 
-        // Load/Compile/Save byext_sets for use by NameColor()
         bool loaded = false, compiled = false;
         for(const char* path: std::initializer_list<const char*>{getenv("HOME"),"",getenv("TEMP"),getenv("TMP"),"/tmp"})
         {
@@ -515,8 +528,19 @@ void PrintSettings()
 
 */
 
+void LoadColors()
+{
+    Settings.LoadByext();
+}
+
 int NameColor(std::string_view name, int default_color)
 {
-    Settings.Load();
+    Settings.LoadByext();
     return Settings.byext_sets.Test(name, default_color);
 }
+
+bool NameColorsBlank()
+{
+    Settings.Load();
+    return Settings.byext_blanks;
+}
@@ -17,11 +17,26 @@ using std::string;
 
 extern bool Dumping;
 
+/* When Monochrome is set, the colours only decide which text is
+ * printed as blanks (the foreground colour is the background colour).
+ * GetNameAttr() then does not match the name against the byext
+ * settings, unless that could change the result. So the matcher
+ * (nor its cache file) is usually never loaded.
+ */
+extern bool Monochrome;
+
 extern bool WasNormalColor;
 extern int GetModeColor(ColorMode m, signed char Chr);
 extern int GetDescrColor(ColorDescr d, int index);
 extern void PrintSettings();
 
 extern int NameColor(std::string_view name, int default_color);
+extern bool NameColorsBlank(); // Whether a byext colour is blanks
+
+/* The settings are loaded at the first lookup. LoadColors() loads
+ * them now, so that the lookups after it only read them, and can
+ * be done in many threads at the same time.
+ */
+extern void LoadColors();
 
 #endif
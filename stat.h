@@ -9,6 +9,7 @@
 #define StatType struct stat64
 #define StatFunc stat64
 #define LStatFunc lstat64
+#define StatAtFunc fstatat64
 
 #define SizeType long long
 
@@ -20,6 +21,7 @@
 #define StatType struct stat
 #define StatFunc stat
 #define LStatFunc lstat
+#define StatAtFunc fstatat
 
 #define SizeType long long
 
@@ -26,6 +26,7 @@ string LastDir;
 bool Totals;
 int TotalSep;
 int Compact;
+bool FreeSpace = true;
 
 void PrintSums()
 {
@@ -65,7 +66,7 @@ void PrintSums()
     ColorNums = GetDescrColor(ColorDescr::NUM, -1);
 
 #ifdef HAVE_STATFS
-    if(STATFS(LastDir.c_str(), &tmp))tmp.f_bavail = 0;
+    if(!FreeSpace || STATFS(LastDir.c_str(), &tmp))tmp.f_bavail = 0;
 #endif
 
     if(Compact)
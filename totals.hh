@@ -13,6 +13,7 @@ extern SizeType SumSizes[10];
 extern bool Totals;
 extern int TotalSep;
 extern int Compact;
+extern bool FreeSpace; // Whether LastDir is on a filesystem that can be asked
 extern string LastDir;
 
 extern void PrintSums();